@@ -8,8 +8,170 @@
 //  information.
 
 // This is the top level unit test file for catch2
-// All this needs to do is define CATCH_CONFIG_MAIN, and include the catch2 header
-// This will define main() and make the magic happen when compiled
+// It provides main(), adding some options to control tracing to the normal catch2 command line
+//
+// --retrace-failures runs every test without tracing, then re-runs each failing test case on its own with tracing forced on
+// The seed is passed on, so the re-run sees exactly the same stimulus. Traces are named after the test case
+// --force-trace records a trace from every model, named after the test case
 
-#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_RUNNER
 #include <catch2/catch.hpp>
+
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "sim/other/SimRandom.hpp"
+#include "sim/verilator/FlightRecorderVcdFile.hpp"
+#include "sim/verilator/VerilatedModel.hpp"
+
+// Most tests check their results after the model has gone out of scope
+// So if a check fails, write out the flight recording of the last model to be destroyed (if it had one) in the same test case
+struct FlightRecorderListener : Catch::TestEventListenerBase
+{
+    using TestEventListenerBase::TestEventListenerBase;
+
+    void testCaseStarting(Catch::TestCaseInfo const &) override
+    {
+        FlightRecorderVcdFile::discardLastRecording();
+    }
+
+    bool assertionEnded(Catch::AssertionStats const &assertionStats) override
+    {
+        if(!assertionStats.assertionResult.isOk())
+        {
+            FlightRecorderVcdFile::writeLastRecording();
+        }
+        return true;
+    }
+};
+CATCH_REGISTER_LISTENER(FlightRecorderListener)
+
+// Names traces and metrics after the test case, and keeps track of which test cases failed
+struct RetraceListener : Catch::TestEventListenerBase
+{
+    using TestEventListenerBase::TestEventListenerBase;
+
+    static inline std::vector<std::string> failed_test_cases;
+
+    void testCaseStarting(Catch::TestCaseInfo const &testInfo) override
+    {
+        TraceOverride::name_prefix = fileSafe(testInfo.name);
+        MetricsContext::startTestCase(testInfo.name);
+    }
+
+    void testCaseEnded(Catch::TestCaseStats const &testCaseStats) override
+    {
+        if(testCaseStats.totals.assertions.failed > 0)
+        {
+            failed_test_cases.push_back(testCaseStats.testInfo.name);
+        }
+    }
+
+private:
+    static std::string fileSafe(const std::string &name)
+    {
+        std::string ret = name;
+        for(auto &c : ret)
+        {
+            if(!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_')
+            {
+                c = '_';
+            }
+        }
+        return ret;
+    }
+};
+CATCH_REGISTER_LISTENER(RetraceListener)
+
+// Catch treats some characters in test specs specially, so escape them to match just the one test case
+static std::string escapeTestName(const std::string &name)
+{
+    std::string ret;
+    for(char c : name)
+    {
+        if(c == '\\' || c == ',' || c == '[' || c == ']' || c == '*' || c == '"' || c == '~')
+        {
+            ret += '\\';
+        }
+        ret += c;
+    }
+    return ret;
+}
+
+// Run a single test case in a fresh process, so that it starts from exactly the same state as it did the first time
+static int runTraced(const std::string &test_name, unsigned int seed)
+{
+    std::vector<std::string> args = {"/proc/self/exe", "--force-trace", "--rng-seed", std::to_string(seed), escapeTestName(test_name)};
+    std::vector<char *> argv;
+    for(auto &arg : args)
+    {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    if(pid < 0)
+    {
+        return -1;
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    Catch::Session session;
+
+    bool retrace_failures = false;
+    bool force_trace = false;
+
+    using namespace Catch::clara;
+    auto cli = session.cli()
+        | Opt(retrace_failures)["--retrace-failures"]("run without tracing, then re-run failing test cases with tracing")
+        | Opt(force_trace)["--force-trace"]("record a trace from every model, named after the test case");
+    session.cli(cli);
+
+    int ret = session.applyCommandLine(argc, argv);
+    if(ret != 0)
+    {
+        return ret;
+    }
+
+    // Tie the stimulus to catch's seed, so that --rng-seed reproduces a run
+    unsigned int seed = session.config().rngSeed();
+    SimRandom::setGlobalSeed(seed);
+
+    if(force_trace)
+    {
+        TraceOverride::mode = TraceOverride::Mode::FORCE_ON;
+    } else if(retrace_failures) {
+        TraceOverride::mode = TraceOverride::Mode::FORCE_OFF;
+    }
+
+    ret = session.run();
+
+    if(retrace_failures)
+    {
+        for(const auto &test_name : RetraceListener::failed_test_cases)
+        {
+            std::cout << "Re-running \"" << test_name << "\" with tracing (--rng-seed " << seed << ")" << std::endl;
+            if(runTraced(test_name, seed) == 0)
+            {
+                std::cout << "\"" << test_name << "\" passed when re-run, so it may not be deterministic" << std::endl;
+            }
+        }
+    }
+
+    return ret;
+}
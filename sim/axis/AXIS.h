@@ -2,9 +2,17 @@
 #define AXIS_H
 
 #include <verilated.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <gsl/pointers>
+#include <type_traits>
 #include <vector>
 
 // Struct of Axis signals so that we can have sane constructors
+// Signals wider than 64 bits are VlWide<N>, which is supported for tdata, tkeep and tusers
 template <class dataT, class keepT=dataT, class userT=dataT, unsigned int n_users=0> struct AxisSignals
 {
     gsl::not_null<vluint8_t *> tready;
@@ -14,6 +22,115 @@ template <class dataT, class keepT=dataT, class userT=dataT, unsigned int n_user
     dataT *tdata = nullptr;
     // Support having multiple user signals as multiple sideband signals are possible
     std::array<userT *, n_users> tusers = {};
+    // Optional stream routing signals. The AXI Stream spec recommends at most 8 bits for tid and 4 for tdest, so verilator always makes these vluint8_t
+    vluint8_t *tid = nullptr;
+    vluint8_t *tdest = nullptr;
 };
 
+// Access AXIS signals as little endian arrays of bytes and bits
+// This lets the peripherals treat integers and VlWide (which verilator uses for ports wider than 64 bits) the same way
+// The bulk operations (storeBytes, loadBytes, countOnes, isLowMask, lowMask) are what the peripherals use per beat,
+// so they work on whole words rather than byte by byte
+template <class T> struct AxisWord
+{
+    static_assert(std::is_integral_v<T>, "AXIS signals must be integers or VlWide");
+    using U = std::make_unsigned_t<T>;
+
+    static constexpr size_t bytes = sizeof(T);
+
+    static uint8_t getByte(const T &word, size_t i) {return static_cast<uint8_t>(word >> (i * 8));};
+    static void setByte(T &word, size_t i, uint8_t byte) {word |= static_cast<T>(static_cast<T>(byte) << (i * 8));};
+    static bool getBit(const T &word, size_t i) {return (word >> i) & 1;};
+    static void setBit(T &word, size_t i) {word |= static_cast<T>(static_cast<T>(1) << i);};
+
+    // Copy the first n bytes out of/into a word. loadBytes expects a zeroed word
+    static void storeBytes(const T &word, uint8_t *dst, size_t n)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            memcpy(dst, &word, n);
+        } else {
+            for(size_t i=0; i < n; i++) dst[i] = getByte(word, i);
+        }
+    }
+    static void loadBytes(T &word, const uint8_t *src, size_t n)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            memcpy(&word, src, n);
+        } else {
+            for(size_t i=0; i < n; i++) setByte(word, i, src[i]);
+        }
+    }
+
+    static size_t countOnes(const T &word) {return std::popcount(static_cast<U>(word));};
+    // True if the set bits are all at the bottom with no gaps, i.e. one less than a power of 2 (including 0)
+    static bool isLowMask(const T &word) {return static_cast<U>(static_cast<U>(word) & static_cast<U>(static_cast<U>(word) + 1)) == 0;};
+    // The bottom n bits set
+    static T lowMask(size_t n) {return (n >= bytes * 8) ? static_cast<T>(~U{0}) : static_cast<T>((U{1} << n) - 1);};
+};
+
+template <std::size_t N> struct AxisWord<VlWide<N>>
+{
+    static constexpr size_t bytes = N * sizeof(EData);
+
+    static uint8_t getByte(const VlWide<N> &word, size_t i) {return static_cast<uint8_t>(word[i / sizeof(EData)] >> ((i % sizeof(EData)) * 8));};
+    static void setByte(VlWide<N> &word, size_t i, uint8_t byte) {word[i / sizeof(EData)] |= static_cast<EData>(byte) << ((i % sizeof(EData)) * 8);};
+    static bool getBit(const VlWide<N> &word, size_t i) {return (word[i / (sizeof(EData) * 8)] >> (i % (sizeof(EData) * 8))) & 1;};
+    static void setBit(VlWide<N> &word, size_t i) {word[i / (sizeof(EData) * 8)] |= static_cast<EData>(1) << (i % (sizeof(EData) * 8));};
+
+    static void storeBytes(const VlWide<N> &word, uint8_t *dst, size_t n)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            memcpy(dst, &word[0], n);
+        } else {
+            for(size_t i=0; i < n; i++) dst[i] = getByte(word, i);
+        }
+    }
+    static void loadBytes(VlWide<N> &word, const uint8_t *src, size_t n)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            memcpy(&word[0], src, n);
+        } else {
+            for(size_t i=0; i < n; i++) setByte(word, i, src[i]);
+        }
+    }
+
+    static size_t countOnes(const VlWide<N> &word)
+    {
+        size_t ones = 0;
+        for(size_t i=0; i < N; i++) ones += std::popcount(word[i]);
+        return ones;
+    }
+    static bool isLowMask(const VlWide<N> &word)
+    {
+        // Every word is all ones, until one that is a low mask, then all the rest are zero
+        size_t i = 0;
+        while(i < N && word[i] == static_cast<EData>(~EData{0})) i++;
+        if(i < N && !AxisWord<EData>::isLowMask(word[i++])) return false;
+        while(i < N) if(word[i++] != 0) return false;
+        return true;
+    }
+    static VlWide<N> lowMask(size_t n)
+    {
+        VlWide<N> word{};
+        for(size_t i=0; i < N; i++)
+        {
+            size_t bits = std::min<size_t>(n - std::min(n, i * sizeof(EData) * 8), sizeof(EData) * 8);
+            word[i] = AxisWord<EData>::lowMask(bits);
+        }
+        return word;
+    }
+};
+
+// N.B. setByte and setBit only set bits, so start from a zeroed word e.g. dataT data{}
+
+// tkeep with a bit set for every byte of tdata
+template <class dataT, class keepT> keepT maxTkeep()
+{
+    return AxisWord<keepT>::lowMask(AxisWord<dataT>::bytes);
+}
+
 #endif //AXIS_H
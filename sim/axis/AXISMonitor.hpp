@@ -0,0 +1,199 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef AXIS_MONITOR_HPP
+#define AXIS_MONITOR_HPP
+
+// Passively watch an AXI Stream interface, e.g. one between two blocks inside the model (verilate with --public to get at those)
+// Never drives anything, so it can be attached to any interface alongside a source or sink
+// Counts where the cycles go: beats transferred, stalls (valid but not ready) and bubbles (ready but not valid)
+// Optionally split into fixed size windows, to see how throughput varies over a run
+
+#include "AXIS.h"
+#include "AxisBeatLog.hpp"
+#include "../other/ClockGen.hpp"
+#include "../verilator/Peripheral.hpp"
+#include "../verilator/VerilatedModel.hpp"
+#include <functional>
+#include <gsl/pointers>
+#include <vector>
+
+// What happened on the interface over a number of cycles (out of reset)
+struct AXISMonitorWindow
+{
+    vluint64_t start_time = 0;
+    vluint64_t cycles = 0;
+    vluint64_t beats = 0;
+    vluint64_t bytes = 0;
+    vluint64_t packets = 0;
+    vluint64_t stall_cycles = 0;
+    vluint64_t bubble_cycles = 0;
+
+    // Fraction of cycles on which a beat was transferred
+    double utilisation(void) const {return cycles ? static_cast<double>(beats) / cycles : 0;};
+    double bytesPerCycle(void) const {return cycles ? static_cast<double>(bytes) / cycles : 0;};
+};
+
+struct AXISMonitorConfig
+{
+    // If set, every accepted beat is appended to this log
+    AxisBeatLog *log = nullptr;
+    // If non-zero, the stats are also gathered in windows of this many cycles, which are kept and passed to on_window
+    vluint64_t window_cycles = 0;
+    std::function<void(const AXISMonitorWindow &)> on_window = nullptr;
+};
+
+template <class dataT, class keepT=dataT, class userT=dataT, unsigned int n_users=0> class AXISMonitor : public Peripheral
+{
+public:
+    AXISMonitor(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, AXISMonitorConfig _config=AXISMonitorConfig{})
+        :Peripheral(model),
+         clk(clk_),
+         sresetn(this, sresetn_, true),
+         tready(this, signals_.tready),
+         tvalid(this, signals_.tvalid),
+         tlast(this, signals_.tlast, true),
+         tkeep(this, signals_.tkeep, maxTkeep<dataT, keepT>()),
+         tdata(this, signals_.tdata),
+         log(_config.log),
+         window_cycles(_config.window_cycles),
+         on_window(std::move(_config.on_window)),
+         metrics(model->getMetrics().instanceScope("AXISMonitor")),
+         packets_counter(metrics.counter("packets")),
+         beats_counter(metrics.counter("beats")),
+         bytes_counter(metrics.counter("bytes")),
+         stall_counter(metrics.counter("stall_cycles")),
+         bubble_counter(metrics.counter("bubble_cycles")),
+         cycles_counter(metrics.counter("cycles"))
+    {
+        for(const auto &tuser_sig : signals_.tusers)
+        {
+            tusers.push_back(InputLatch<userT>(this, tuser_sig));
+        }
+        if(log)
+        {
+            log->setResolution(clk->getResolution());
+        }
+    };
+
+    ~AXISMonitor()
+    {
+        metrics.gauge("utilisation").set(getTotals().utilisation());
+        metrics.gauge("bytes_per_cycle").set(getTotals().bytesPerCycle());
+    }
+
+    void eval(void) override
+    {
+        if(clk->getEvent() == ClockGen::Event::RISING && sresetn == 1)
+        {
+            if(window_cycles && window.cycles == window_cycles)
+            {
+                endWindow();
+            }
+            if(window.cycles == 0)
+            {
+                window.start_time = clk->getTime();
+            }
+            window.cycles++;
+            cycles_counter.increment();
+
+            if(tready && tvalid)
+            {
+                countBeat();
+            } else if(tvalid) {
+                window.stall_cycles++;
+                stall_counter.increment();
+            } else if(tready) {
+                window.bubble_cycles++;
+                bubble_counter.increment();
+            }
+        }
+    }
+
+    vluint64_t getNumPackets(void) const {return packets_counter.get();};
+    vluint64_t getNumBeats(void) const {return beats_counter.get();};
+
+    // Stats for the whole run so far
+    AXISMonitorWindow getTotals(void) const
+    {
+        return AXISMonitorWindow{
+            .start_time = 0,
+            .cycles = cycles_counter.get(),
+            .beats = beats_counter.get(),
+            .bytes = bytes_counter.get(),
+            .packets = packets_counter.get(),
+            .stall_cycles = stall_counter.get(),
+            .bubble_cycles = bubble_counter.get()
+        };
+    }
+
+    // Completed windows, oldest first
+    const std::vector<AXISMonitorWindow> &getWindows(void) const {return windows;};
+
+private:
+    ClockGen *clk;
+    InputLatch<vluint8_t> sresetn;
+    InputLatch<vluint8_t> tready;
+    InputLatch<vluint8_t> tvalid;
+    InputLatch<vluint8_t> tlast;
+    InputLatch<keepT> tkeep;
+    InputLatch<dataT> tdata;
+    std::vector<InputLatch<userT>> tusers;
+
+    AxisBeatLog *log;
+
+    vluint64_t window_cycles;
+    std::function<void(const AXISMonitorWindow &)> on_window;
+    AXISMonitorWindow window;
+    std::vector<AXISMonitorWindow> windows;
+
+    MetricsScope metrics;
+    MetricsCounter &packets_counter;
+    MetricsCounter &beats_counter;
+    MetricsCounter &bytes_counter;
+    MetricsCounter &stall_counter;
+    MetricsCounter &bubble_counter;
+    MetricsCounter &cycles_counter;
+
+    void countBeat(void)
+    {
+        size_t bytes = tdata.is_null() ? 0 : AxisWord<keepT>::countOnes(tkeep);
+        window.beats++;
+        window.bytes += bytes;
+        beats_counter.increment();
+        bytes_counter.increment(bytes);
+        if(tlast)
+        {
+            window.packets++;
+            packets_counter.increment();
+        }
+
+        if(log)
+        {
+            std::array<userT, n_users> users;
+            for(size_t i=0; i < n_users; i++)
+            {
+                users[i] = tusers[i];
+            }
+            log->append(clk->getTime(), static_cast<dataT>(tdata), static_cast<keepT>(tkeep), tlast, users);
+        }
+    }
+
+    void endWindow(void)
+    {
+        windows.push_back(window);
+        if(on_window)
+        {
+            on_window(window);
+        }
+        window = AXISMonitorWindow{};
+    }
+};
+
+#endif
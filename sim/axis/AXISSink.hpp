@@ -13,44 +13,49 @@
 // Receive an AXIS stream and save it to a std::vector
 
 #include "AXIS.h"
+#include "AxisBeatLog.hpp"
+#include "AxisFlowControl.hpp"
+#include "LatencyTracker.hpp"
 #include "../other/ClockGen.hpp"
 #include "../other/PacketSourceSink.hpp"
+#include "../other/SimRandom.hpp"
 #include "../verilator/Peripheral.hpp"
 #include "../verilator/VerilatedModel.hpp"
 #include <gsl/pointers>
 #include <vector>
 
-struct AXISSinkConfig
+struct AXISSinkException : std::runtime_error
 {
-    bool packed = false;
+    using std::runtime_error::runtime_error;
 };
 
-template <class dataT, class keepT> keepT static constexpr maxTkeep()
+struct AXISSinkConfig
 {
-    return static_cast<keepT>((1 << sizeof(dataT))-1);
-}
+    bool packed = false;
+    // If set, every accepted beat is appended to this log
+    AxisBeatLog *log = nullptr;
+    // When tready is asserted, to apply backpressure
+    AxisFlowControl flow_control = AxisFlowControl::always();
+    // If set, each packet is matched on tlast to one recorded by an AXISSource using the same tracker, to measure latency
+    LatencyTracker *latency = nullptr;
+    // Perturbs the flow control. Combined with the global seed and instance name, so can usually be left as 0
+    uint64_t seed = 0;
+};
 
 template <class dataT, class keepT=dataT, class userT=dataT, unsigned int n_users=0> class AXISSink : public Peripheral
 {
 public:
 	AXISSink(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, PacketSink<uint8_t> *data_sink_, std::array<PacketSink<userT>*, n_users> users_sink_=std::array<PacketSink<userT>*, n_users>{}, AXISSinkConfig _config=AXISSinkConfig{})
-		:Peripheral(model),
-		 clk(clk_),
-		 sresetn(this, sresetn_, true),
-		 tready(signals_.tready),
-		 tvalid(this, signals_.tvalid, true),
-		 tlast(this, signals_.tlast, true),
-		 tkeep(this, signals_.tkeep, maxTkeep<dataT, keepT>()),
-		 tdata(this, signals_.tdata),
-		 data_sink(data_sink_),
-		 users_sink(users_sink_),
-		 packed(_config.packed)
+		:AXISSink(model, clk_, sresetn_, signals_, std::vector<PacketSink<uint8_t> *>{data_sink_}, users_sink_, _config, false)
 	{
-		for(const auto&tuser_sig : signals_.tusers)
-        {
-		    tusers.push_back(InputLatch<userT>(this, tuser_sig));
-        }
-		resetState();
+	};
+
+	// Demultiplex packets by tdest, sending those with tdest == i to dest_sinks[i]
+	// Packets with different tdests can be interleaved beat by beat, as the AXI Stream spec allows
+	AXISSink(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, std::vector<PacketSink<uint8_t> *> dest_sinks_, std::array<PacketSink<userT>*, n_users> users_sink_=std::array<PacketSink<userT>*, n_users>{}, AXISSinkConfig _config=AXISSinkConfig{})
+		:AXISSink(model, clk_, sresetn_, signals_, std::move(dest_sinks_), users_sink_, _config, true)
+	{
+		if(tdest.is_null()) throw AXISSinkException("Demultiplexing by tdest requires a tdest signal");
 	};
 
 	void eval(void) override
@@ -59,84 +64,150 @@ public:
 		{
 			if (sresetn == 1)
 			{
+				cycles_counter.increment();
+				if(tvalid && !tready)
+				{
+					backpressure_counter.increment();
+				}
+
 				if(tready && tvalid)
 				{
-					if(!tdata.is_null())
-					{
+					beats_counter.increment();
+					flow_control.used();
 
-                        // Check tkeep
-                        if(packed) {
-                            if (tkeep > maxTkeep<dataT, keepT>())
-                            {
-                                throw std::runtime_error("tkeep indicating more bytes are valid than bytes that exist, on last beat! This should be impossible without mis-sized vectors!");
-                            }
+					if(log)
+					{
+					    logBeat();
+					}
 
-                            // Enforce that all bits are unset after the first unset bit. I.e tkeep is one less than a power of 2
-                            bool seen_unset_bit = false;
-                            for(int i=0; i<sizeof(dataT); i++)
-                            {
-                                bool current_bit_set = tkeep & (1 << i);
-                                if(seen_unset_bit && current_bit_set)
-                                {
-                                    throw("tkeep is unpacked on tlast");
-                                }
-                                seen_unset_bit |= (!current_bit_set);
-                            }
+					Stream &stream = currentStream();
 
-                            if (!tlast)
-                            {
-                                if (tkeep != maxTkeep<dataT, keepT>())
-                                {
-                                    throw std::runtime_error("tkeep not all ones with tlast false");
-                                }
-                            }
-                        }
+					if(!tdata.is_null())
+					{
 
-                        // Store the data byte by byte
                         dataT data = tdata;
                         keepT keep = tkeep;
-                        for(size_t i=0; i<sizeof(dataT); i++)
-                        {
-                            if(keep & 1)
-                            {
-                                cur_data.push_back(data & 0xFF);
-                            }
-                            keep >>= 1;
-                            data >>= 8;
+
+                        // Check tkeep
+                        if(packed) {
+                            checkPackedTkeep(keep);
                         }
+
+                        storeBeat(*stream.data, data, keep);
                     }
 
-                    for(size_t i=0; i < curUsers.size(); i++)
+                    for(size_t i=0; i < n_users; i++)
                     {
-                        curUsers.at(i).push_back(tusers.at(i));
+                        stream.users.at(i).push_back(tusers.at(i));
                     }
 
                     // Dispatch the completed packets on tlast
 					if(tlast)
 					{
-					    if(data_sink)
+					    packets_counter.increment();
+					    bytes_counter.increment(stream.data->size());
+					    if(demux)
 					    {
-                            data_sink->send(cur_data);
+					        stream.packets->increment();
+					        stream.bytes->increment(stream.data->size());
+					    }
+					    if(latency)
+					    {
+					        latency->packetReceived(clk->getTime(), stream.data.span());
+					    }
+
+					    if(stream.sink)
+					    {
+                            // Hand the buffer over, rather than copying it, then start a new one
+                            stream.sink->sendPooled(std::move(stream.data));
+                            stream.data = pool.acquire();
+                        } else {
+                            stream.data->clear();
                         }
 
-                        cur_data = {};
-					    for(size_t i=0; i < curUsers.size(); i++)
+					    for(size_t i=0; i < n_users; i++)
                         {
 					        if(users_sink.at(i))
                             {
-                                users_sink.at(i)->send(curUsers[i]);
+                                users_sink.at(i)->send(stream.users[i]);
                             }
-                            curUsers.at(i) = {};
+                            stream.users.at(i).clear();
                         }
 					}
 				}
+
+				tready = flow_control.allow(random);
 			} else {
 				resetState();
 			}
 		}
 	}
 
+	~AXISSink()
+	{
+	    metrics.gauge("beats_per_cycle").set(getBeatsPerCycle());
+	}
+
+	vluint64_t getNumPackets(void) const {return packets_counter.get();};
+
+	// Accepted beats per cycle out of reset, i.e. the throughput achieved
+	double getBeatsPerCycle(void) const
+	{
+	    return cycles_counter.get() ? static_cast<double>(beats_counter.get()) / cycles_counter.get() : 0;
+	}
+
+	// Packets and bytes received for a tdest, when demultiplexing
+	vluint64_t getNumPackets(size_t dest) const {return streams.at(dest).packets->get();};
+	vluint64_t getNumBytes(size_t dest) const {return streams.at(dest).bytes->get();};
+
 private:
+	AXISSink(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, std::vector<PacketSink<uint8_t> *> data_sinks_, std::array<PacketSink<userT>*, n_users> users_sink_, AXISSinkConfig _config, bool demux_)
+		:Peripheral(model),
+		 clk(clk_),
+		 sresetn(this, sresetn_, true),
+		 tready(signals_.tready),
+		 tvalid(this, signals_.tvalid, true),
+		 tlast(this, signals_.tlast, true),
+		 tkeep(this, signals_.tkeep, maxTkeep<dataT, keepT>()),
+		 tdata(this, signals_.tdata),
+		 tdest(this, signals_.tdest),
+		 users_sink(users_sink_),
+		 demux(demux_),
+		 packed(_config.packed),
+		 log(_config.log),
+		 latency(_config.latency),
+		 metrics(model->getMetrics().instanceScope("AXISSink")),
+		 packets_counter(metrics.counter("packets")),
+		 beats_counter(metrics.counter("beats")),
+		 bytes_counter(metrics.counter("bytes")),
+		 backpressure_counter(metrics.counter("backpressure_cycles")),
+		 cycles_counter(metrics.counter("cycles")),
+		 flow_control(_config.flow_control),
+		 random(SimRandom::deriveSeed(metrics.getPrefix(), _config.seed))
+	{
+		for(const auto&tuser_sig : signals_.tusers)
+        {
+		    tusers.push_back(InputLatch<userT>(this, tuser_sig));
+        }
+		for(size_t i=0; i < data_sinks_.size(); i++)
+		{
+		    streams.push_back(Stream{data_sinks_[i], pool.acquire()});
+		    if(demux)
+		    {
+		        streams.back().packets = &metrics.counter("tdest" + std::to_string(i) + ".packets");
+		        streams.back().bytes = &metrics.counter("tdest" + std::to_string(i) + ".bytes");
+		    } else {
+		        streams.back().packets = &packets_counter;
+		        streams.back().bytes = &bytes_counter;
+		    }
+		}
+		if(log)
+		{
+		    log->setResolution(clk->getResolution());
+		}
+		resetState();
+	};
+
     ClockGen *clk;
     InputLatch<vluint8_t> sresetn;
     OutputWrapper<vluint8_t> tready;
@@ -144,21 +215,123 @@ private:
 	InputLatch <vluint8_t> tlast;
     InputLatch <keepT> tkeep;
 	InputLatch <dataT> tdata;
+	InputLatch <vluint8_t> tdest;
 
     std::vector<InputLatch<userT>> tusers;
 
-    std::vector<uint8_t> cur_data;
-    std::array<std::vector<userT>, n_users> curUsers;
+    // Buffers go back to the pool once the sink is done with them, so steady state reception doesn't allocate
+    PacketPool<uint8_t> pool;
+
+    // The packet being received for each tdest (or just the one, if not demultiplexing)
+    struct Stream
+    {
+        PacketSink<uint8_t> *sink;
+        PacketHandle<uint8_t> data;
+        std::array<std::vector<userT>, n_users> users = {};
+        MetricsCounter *packets = nullptr;
+        MetricsCounter *bytes = nullptr;
+    };
+    std::vector<Stream> streams;
 
-    PacketSink<uint8_t> *data_sink;
     std::array<PacketSink<userT>*, n_users> users_sink;
 
+    bool demux;
     bool packed;
+    AxisBeatLog *log;
+    LatencyTracker *latency;
+
+    MetricsScope metrics;
+    MetricsCounter &packets_counter;
+    MetricsCounter &beats_counter;
+    MetricsCounter &bytes_counter;
+    MetricsCounter &backpressure_counter;
+    MetricsCounter &cycles_counter;
+
+    AxisFlowControl flow_control;
+    SimRandom random;
+
+    Stream &currentStream(void)
+    {
+        if(!demux)
+        {
+            return streams[0];
+        }
+        vluint8_t dest = tdest;
+        if(dest >= streams.size())
+        {
+            throw AXISSinkException("Received tdest " + std::to_string(dest) + ", but there are only " + std::to_string(streams.size()) + " sinks");
+        }
+        return streams[dest];
+    }
+
+    void storeBeat(std::vector<uint8_t> &cur_data, const dataT &data, const keepT &keep)
+    {
+        // Packed beats (which is nearly all of them) are copied in one go, only sparse tkeep needs to go byte by byte
+        if(AxisWord<keepT>::isLowMask(keep))
+        {
+            size_t n = std::min(AxisWord<keepT>::countOnes(keep), AxisWord<dataT>::bytes);
+            size_t old_size = cur_data.size();
+            cur_data.resize(old_size + n);
+            AxisWord<dataT>::storeBytes(data, cur_data.data() + old_size, n);
+        } else {
+            for(size_t i=0; i<AxisWord<dataT>::bytes; i++)
+            {
+                if(AxisWord<keepT>::getBit(keep, i))
+                {
+                    cur_data.push_back(AxisWord<dataT>::getByte(data, i));
+                }
+            }
+        }
+    }
+
+    void checkPackedTkeep(const keepT &keep)
+    {
+        // Enforce that all bits are unset after the first unset bit. I.e tkeep is one less than a power of 2
+        if(!AxisWord<keepT>::isLowMask(keep))
+        {
+            // Work out what was wrong with it, this is only done on failure so can be slow
+            for(size_t i=AxisWord<dataT>::bytes; i < AxisWord<keepT>::bytes * 8; i++)
+            {
+                if(AxisWord<keepT>::getBit(keep, i))
+                {
+                    throw std::runtime_error("tkeep indicating more bytes are valid than bytes that exist, on last beat! This should be impossible without mis-sized vectors!");
+                }
+            }
+            throw std::runtime_error("tkeep is unpacked on tlast");
+        }
+
+        size_t n = AxisWord<keepT>::countOnes(keep);
+        if(n > AxisWord<dataT>::bytes)
+        {
+            throw std::runtime_error("tkeep indicating more bytes are valid than bytes that exist, on last beat! This should be impossible without mis-sized vectors!");
+        }
+
+        if (!tlast && n != AxisWord<dataT>::bytes)
+        {
+            throw std::runtime_error("tkeep not all ones with tlast false");
+        }
+    }
+
+    void logBeat(void)
+    {
+        std::array<userT, n_users> user_values;
+        for(size_t i=0; i < n_users; i++)
+        {
+            user_values[i] = tusers[i];
+        }
+        log->append(clk->getTime(), static_cast<dataT>(tdata), static_cast<keepT>(tkeep), tlast, user_values);
+    }
 
 	void resetState(void)
 	{
-        cur_data = {};
-        curUsers = {};
+        for(auto &stream : streams)
+        {
+            stream.data->clear();
+            for(auto &user : stream.users)
+            {
+                user.clear();
+            }
+        }
 		tready = 1;
 	}
 
@@ -15,11 +15,29 @@
 #include <vector>
 #include "../other/ClockGen.hpp"
 #include "../verilator/Peripheral.hpp"
-#include "../other/PacketSourceSink.hpp"
+#include "../verilator/VerilatedModel.hpp"
+#include "../other/PacketLease.hpp"
+#include "../other/SimRandom.hpp"
+#include "AXIS.h"
+#include "AxisFlowControl.hpp"
+#include "LatencyTracker.hpp"
+#include "AxisBeatLog.hpp"
 
 struct AXISSourceConfig
 {
     bool packed = true;
+    // How the next flow to send a packet from is picked, when there is more than one
+    // Round robin sends weight packets from each flow in turn, random picks each packet's flow with probability proportional to weight
+    enum class FlowOrder {ROUND_ROBIN, RANDOM};
+    FlowOrder flow_order = FlowOrder::ROUND_ROBIN;
+    // If set, every accepted beat is appended to this log
+    AxisBeatLog *log = nullptr;
+    // When tvalid may be asserted, to throttle the stream
+    AxisFlowControl flow_control = AxisFlowControl::always();
+    // If set, the time each packet starts being accepted is recorded here, to measure latency to an AXISSink using the same tracker
+    LatencyTracker *latency = nullptr;
+    // Perturbs the random byte gaps (when unpacked) and flow control. Combined with the global seed and instance name, so can usually be left as 0
+    uint64_t seed = 0;
 };
 
 struct AXISSourceException : std::runtime_error
@@ -27,36 +45,50 @@ struct AXISSourceException : std::runtime_error
     using std::runtime_error::runtime_error;
 };
 
+// A logical stream of packets, sent with its own tid and tdest
+struct AxisSourceFlow
+{
+    AnyPacketSource<uint8_t> source;
+    vluint8_t tid = 0;
+    vluint8_t tdest = 0;
+    unsigned int weight = 1;
+};
+
 // Helper class to handle the sideband tuser signal
 template <class userT> class AxisSourceUserHandler
 {
 public:
-    AxisSourceUserHandler(userT *tuser_, gsl::not_null<PacketSource<userT> *> source_)
-    :tuser(tuser_), source(source_)
+    AxisSourceUserHandler() = default;
+
+    AxisSourceUserHandler(userT *tuser_, AnyPacketSource<userT> source_)
+    :tuser(tuser_), source(std::move(source_))
     {
     }
 
     // Call this to output the next value i.e. when tready and tvalid
     void output(bool last)
     {
-        if(last && iter != current_packet.end()) throw("AxisSource output last, but tuser packet wasn't empty");
-        if(iter == current_packet.end())
+        if(iter == end)
         {
-            auto maybe_new_packet = source->receive();
-            if(!maybe_new_packet) throw AXISSourceException("tuser packet source couldn't provide packet when required");
-            current_packet = *maybe_new_packet;
-            iter = current_packet.begin();
+            current_packet.reset();
+            current_packet = source->lease();
+            if(!current_packet) throw AXISSourceException("tuser packet source couldn't provide packet when required");
+            iter = current_packet->begin();
+            end = current_packet->end();
         }
         tuser = *(iter++);
+        if(last && iter != end) throw AXISSourceException("AxisSource output last, but tuser packet wasn't empty");
     }
 
-    std::vector<userT> current_packet;
-    typename std::vector<userT>::const_iterator iter = current_packet.end();
+    // The value currently being output
+    userT value(void) const {return tuser;}
 
 private:
-    OutputWrapper<userT> tuser;
-    PacketSource<userT> *source;
-
+    OutputWrapper<userT> tuser{nullptr};
+    std::optional<AnyPacketSource<userT>> source;
+    std::optional<PacketLease<userT>> current_packet;
+    const userT *iter = nullptr;
+    const userT *end = nullptr;
 };
 
 // Due to the way that we are structured, we mandate that a data source is provided
@@ -67,15 +99,57 @@ private:
 template <class dataT, class keepT=dataT, class userT=dataT, unsigned int n_users=0>class AXISSource : public Peripheral
 {
 public:
-	AXISSource(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, gsl::not_null<PacketSource<uint8_t> *> data_source_, std::array<PacketSource<userT>*, n_users> users_source_=std::array<PacketSource<userT>*, n_users>{}, AXISSourceConfig _config=AXISSourceConfig{})
-		:Peripheral(model), clk(clk_), sresetn(this, sresetn_, 1), tready(this, signals_.tready, 1), tvalid(signals_.tvalid), tlast(signals_.tlast), tkeep(signals_.tkeep), tdata(signals_.tdata), data_source(data_source_), output_packed(_config.packed)
+	AXISSource(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, AnyPacketSource<uint8_t> data_source_, std::array<PacketSource<userT>*, n_users> users_source_=std::array<PacketSource<userT>*, n_users>{}, AXISSourceConfig _config=AXISSourceConfig{})
+		:AXISSource(model, clk_, sresetn_, signals_, singleFlow(std::move(data_source_)), users_source_, _config)
 	{
+	};
+
+	// Interleave packets from several flows, a packet at a time, setting tid and tdest for each
+	AXISSource(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, const gsl::not_null<vluint8_t *> sresetn_, const AxisSignals<dataT, keepT, userT, n_users> &signals_, std::vector<AxisSourceFlow> flows_, std::array<PacketSource<userT>*, n_users> users_source_=std::array<PacketSource<userT>*, n_users>{}, AXISSourceConfig _config=AXISSourceConfig{})
+		:Peripheral(model), clk(clk_), sresetn(this, sresetn_, 1), tready(this, signals_.tready, 1), tvalid(signals_.tvalid), tlast(signals_.tlast), tkeep(signals_.tkeep), tdata(signals_.tdata), tid(signals_.tid), tdest(signals_.tdest), output_packed(_config.packed), log(_config.log), latency(_config.latency), flows(std::move(flows_)), flow_order(_config.flow_order),
+		 metrics(model->getMetrics().instanceScope("AXISSource")),
+		 packets_counter(metrics.counter("packets")),
+		 beats_counter(metrics.counter("beats")),
+		 bytes_counter(metrics.counter("bytes")),
+		 stall_counter(metrics.counter("stall_cycles")),
+		 cycles_counter(metrics.counter("cycles")),
+		 flow_control(_config.flow_control),
+		 random(SimRandom::deriveSeed(metrics.getPrefix(), _config.seed))
+	{
+	    if(flows.empty()) throw AXISSourceException("AXISSource needs at least one flow");
+	    // Start round robin from the first flow
+	    current_flow = flows.size() - 1;
+	    tid = flows[0].tid;
+	    tdest = flows[0].tdest;
+	    // Per flow counts are only worth having if there is more than one
+	    if(flows.size() > 1)
+        {
+            for(size_t i=0; i < flows.size(); i++)
+            {
+                flows_stats.push_back(FlowStats{&metrics.counter("flow" + std::to_string(i) + ".packets"), &metrics.counter("flow" + std::to_string(i) + ".bytes")});
+                total_weight += flows[i].weight;
+            }
+        }
 	    for(size_t i=0; i < n_users; i++)
         {
             users.at(i) = AxisSourceUserHandler<userT>(signals_.tusers.at(i), users_source_.at(i));
         }
+		if(log)
+		{
+		    log->setResolution(clk->getResolution());
+		}
 		tvalid = 0;
 	};
+
+	// Packets sent from a flow, when there is more than one
+	vluint64_t getNumPackets(size_t flow) const {return flows_stats.at(flow).packets->get();};
+	vluint64_t getNumBytes(size_t flow) const {return flows_stats.at(flow).bytes->get();};
+
+	~AXISSource()
+	{
+	    metrics.gauge("beats_per_cycle").set(getBeatsPerCycle());
+	}
+
 	void eval(void) override
 	{
 		if((clk->getEvent() == ClockGen::Event::RISING))
@@ -84,14 +158,45 @@ public:
 			{
                 tvalid = 0;
             } else {
+				cycles_counter.increment();
+				bool allowed = flow_control.allow(random);
+				if(tvalid && !tready)
+				{
+				    stall_counter.increment();
+				}
+				if(tready && tvalid)
+				{
+				    countBeat();
+				    flow_control.used();
+				    if(latency && beat_first)
+				    {
+				        latency->packetSent(clk->getTime(), current_packet->span());
+				    }
+				    if(log)
+				    {
+				        logBeat();
+				    }
+				}
 				if((tready && tvalid) || (!tvalid))
 				{
-                    setupNextData();
+				    // Once tvalid is asserted it has to stay asserted until the beat is taken, so only throttle between beats
+				    if(allowed)
+				    {
+				        setupNextData();
+				    } else {
+				        tvalid = 0;
+				    }
                 }
 			}
 		}
 	}
 
+	// Accepted beats per cycle out of reset, i.e. the throughput achieved
+	double getBeatsPerCycle(void) const
+	{
+	    return cycles_counter.get() ? static_cast<double>(beats_counter.get()) / cycles_counter.get() : 0;
+	}
+
 private:
 	ClockGen *clk;
     InputLatch<vluint8_t> sresetn;
@@ -100,14 +205,133 @@ private:
     OutputWrapper<vluint8_t> tlast;
     OutputWrapper<keepT> tkeep;
     OutputWrapper<dataT> tdata;
+    OutputWrapper<vluint8_t> tid;
+    OutputWrapper<vluint8_t> tdest;
 
     std::array<AxisSourceUserHandler<userT>, n_users> users;
 
     bool output_packed;
+    AxisBeatLog *log;
+    LatencyTracker *latency;
+
+    // Packets are leased, so sources that own their data (e.g. mmap'd files) are sent without being copied
+    std::vector<AxisSourceFlow> flows;
+    AXISSourceConfig::FlowOrder flow_order;
+    size_t current_flow = 0;
+    // Round robin only, packets left to send from the current flow before moving on
+    unsigned int turn_left = 0;
+    unsigned int total_weight = 0;
+    std::optional<PacketLease<uint8_t>> current_packet;
+
+    struct FlowStats
+    {
+        MetricsCounter *packets;
+        MetricsCounter *bytes;
+    };
+    std::vector<FlowStats> flows_stats;
+    const uint8_t *iter = nullptr;
+    const uint8_t *end = nullptr;
+
+    MetricsScope metrics;
+    MetricsCounter &packets_counter;
+    MetricsCounter &beats_counter;
+    MetricsCounter &bytes_counter;
+    MetricsCounter &stall_counter;
+    MetricsCounter &cycles_counter;
+
+    AxisFlowControl flow_control;
+    SimRandom random;
+
+    // What the beat currently being output holds, for the metrics. tlast and tkeep are optional so can't be used
+    size_t beat_bytes = 0;
+    bool beat_first = false;
+    bool beat_last = false;
+    size_t beat_flow = 0;
+
+    void countBeat(void)
+    {
+        beats_counter.increment();
+        bytes_counter.increment(beat_bytes);
+        if(beat_last)
+        {
+            packets_counter.increment();
+        }
+        if(!flows_stats.empty())
+        {
+            flows_stats[beat_flow].bytes->increment(beat_bytes);
+            if(beat_last)
+            {
+                flows_stats[beat_flow].packets->increment();
+            }
+        }
+    }
+
+    static std::vector<AxisSourceFlow> singleFlow(AnyPacketSource<uint8_t> source)
+    {
+        std::vector<AxisSourceFlow> ret;
+        ret.push_back(AxisSourceFlow{std::move(source)});
+        return ret;
+    }
 
-    PacketSource<uint8_t> *data_source;
-    std::vector<uint8_t> current_packet;
-    typename std::vector<uint8_t>::const_iterator iter = current_packet.end();
+    // Get a packet from the next flow, skipping over any that have nothing to send right now
+    std::optional<PacketLease<uint8_t>> nextPacket(void)
+    {
+        if(flows.size() == 1)
+        {
+            return flows[0].source.lease();
+        }
+
+        size_t first;
+        if(flow_order == AXISSourceConfig::FlowOrder::RANDOM)
+        {
+            first = pickRandomFlow();
+        } else {
+            first = (turn_left == 0) ? (current_flow + 1) % flows.size() : current_flow;
+        }
+
+        for(size_t i=0; i < flows.size(); i++)
+        {
+            size_t flow = (first + i) % flows.size();
+            auto packet = flows[flow].source.lease();
+            if(packet)
+            {
+                if(flow != current_flow || turn_left == 0)
+                {
+                    turn_left = flows[flow].weight;
+                }
+                turn_left--;
+                current_flow = flow;
+                tid = flows[flow].tid;
+                tdest = flows[flow].tdest;
+                return packet;
+            }
+        }
+        return std::nullopt;
+    }
+
+    size_t pickRandomFlow(void)
+    {
+        uint64_t pick = random.nextBelow(total_weight);
+        for(size_t i=0; i < flows.size(); i++)
+        {
+            if(pick < flows[i].weight)
+            {
+                return i;
+            }
+            pick -= flows[i].weight;
+        }
+        return 0;
+    }
+
+    void logBeat(void)
+    {
+        std::array<userT, n_users> user_values;
+        for(size_t i=0; i < n_users; i++)
+        {
+            user_values[i] = users[i].value();
+        }
+        log->append(clk->getTime(), static_cast<dataT>(tdata), static_cast<keepT>(tkeep), tlast, user_values);
+    }
 
 	void setupNextData(void)
     {
@@ -115,36 +339,51 @@ private:
         tvalid = 0;
 
         // If we have run out of data, try and get more
-        if(iter == current_packet.end())
+        if(iter == end)
         {
-            auto maybe_new_packet = data_source->receive();
-            if(maybe_new_packet) {
-                current_packet = *maybe_new_packet;
-                iter = current_packet.begin();
+            // Give the old packet back first, so its buffer can be reused for the new one
+            current_packet.reset();
+            current_packet = nextPacket();
+            if(current_packet) {
+                iter = current_packet->begin();
+                end = current_packet->end();
             }
         }
 
         // If we have data to give, present that
-	    if(iter != current_packet.end())
+	    if(iter != end)
         {
+            beat_first = (iter == current_packet->begin());
 
-            int max_num_bytes = std::min<int>(current_packet.end()-iter, sizeof(dataT));
-
-            tvalid = 1;
-            tdata = 0;
-            tkeep = 0;
+            size_t max_num_bytes = std::min<size_t>(end-iter, AxisWord<dataT>::bytes);
 
-            for(int i=0; i<max_num_bytes; i++)
+            // Build the beat up locally, so that it works for VlWide as well as integers
+            dataT data{};
+            keepT keep{};
+            if(output_packed)
             {
-
-                if(output_packed || (rand() > (RAND_MAX / 2)))
+                AxisWord<dataT>::loadBytes(data, iter, max_num_bytes);
+                keep = AxisWord<keepT>::lowMask(max_num_bytes);
+                iter += max_num_bytes;
+            } else {
+                for(size_t i=0; i<max_num_bytes; i++)
                 {
-                    tdata = tdata | (*(iter++) << i * 8);
-                    tkeep = tkeep | (1 << i);
+                    if(random.nextBool())
+                    {
+                        AxisWord<dataT>::setByte(data, i, *(iter++));
+                        AxisWord<keepT>::setBit(keep, i);
+                    }
                 }
             }
 
-            tlast = (iter == current_packet.end());
+            tvalid = 1;
+            tdata = data;
+            tkeep = keep;
+
+            beat_bytes = AxisWord<keepT>::countOnes(keep);
+            beat_last = (iter == end);
+            beat_flow = current_flow;
+            tlast = beat_last;
             for(auto &user : users)
             {
                 if(!output_packed) throw(AXISSourceException("tdata requested to be sent unpacked, whilst tusers also being used"));
@@ -0,0 +1,300 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef AXIS_BEAT_LOG_HPP
+#define AXIS_BEAT_LOG_HPP
+
+// Compact binary log of the beats accepted on an AXI Stream interface
+// Each beat is a fixed size record of time, tdata, tkeep, tusers and tlast, appended to a memory mapped file
+// This is much cheaper than a VCD, so can be left on for long runs. Use axis_log_convert to turn it into VCD or CSV
+// N.B. Values are stored in the native byte order, so logs should be converted on the same kind of machine
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct AxisBeatLogException : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct AxisBeatLogHeader
+{
+    static constexpr char expected_magic[8] = {'A', 'X', 'I', 'S', 'B', 'L', 'O', 'G'};
+    static constexpr uint32_t expected_version = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_bytes;
+    uint32_t data_bytes;
+    uint32_t keep_bytes;
+    uint32_t user_bytes;
+    uint32_t n_users;
+    // Seconds per tick of the record times, i.e. the resolution of the ClockGen they came from. 0 if unknown
+    double resolution;
+    // Updated after every beat, so a log from a crashed simulation can still be read
+    uint64_t num_records;
+};
+
+// Where each field lives within a record
+struct AxisBeatLogLayout
+{
+    AxisBeatLogLayout(uint32_t data_bytes_, uint32_t keep_bytes_, uint32_t user_bytes_, uint32_t n_users_)
+        :data_bytes(data_bytes_), keep_bytes(keep_bytes_), user_bytes(user_bytes_), n_users(n_users_),
+         data_offset(sizeof(uint64_t)),
+         keep_offset(data_offset + data_bytes),
+         user_offset(keep_offset + keep_bytes),
+         last_offset(user_offset + user_bytes * n_users),
+         // Keep the time of each record aligned
+         record_bytes((last_offset + 1 + 7) & ~7u)
+    {
+    }
+
+    const uint32_t data_bytes;
+    const uint32_t keep_bytes;
+    const uint32_t user_bytes;
+    const uint32_t n_users;
+    const uint32_t data_offset;
+    const uint32_t keep_offset;
+    const uint32_t user_offset;
+    const uint32_t last_offset;
+    const uint32_t record_bytes;
+};
+
+class AxisBeatLog
+{
+public:
+    // The sizes must match the types of the interface being logged, which is checked on every append
+    AxisBeatLog(const std::string &filename, uint32_t data_bytes, uint32_t keep_bytes, uint32_t user_bytes=0, uint32_t n_users=0)
+        :layout(data_bytes, keep_bytes, user_bytes, n_users)
+    {
+        fd = ::open(filename.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0666);
+        if(fd < 0)
+        {
+            throw AxisBeatLogException("Couldn't open AXIS beat log " + filename + ": " + strerror(errno));
+        }
+
+        try
+        {
+            resize(initial_capacity);
+        } catch(...) {
+            ::close(fd);
+            throw;
+        }
+
+        auto header = getHeader();
+        memcpy(header->magic, AxisBeatLogHeader::expected_magic, sizeof(header->magic));
+        header->version = AxisBeatLogHeader::expected_version;
+        header->record_bytes = layout.record_bytes;
+        header->data_bytes = layout.data_bytes;
+        header->keep_bytes = layout.keep_bytes;
+        header->user_bytes = layout.user_bytes;
+        header->n_users = layout.n_users;
+        header->resolution = 0;
+        header->num_records = 0;
+    }
+
+    // Make a log with the right sizes for an interface
+    template <class dataT, class keepT=dataT, class userT=dataT, unsigned int n_users=0> static AxisBeatLog forInterface(const std::string &filename)
+    {
+        return AxisBeatLog(filename, sizeof(dataT), sizeof(keepT), n_users ? sizeof(userT) : 0, n_users);
+    }
+
+    AxisBeatLog(AxisBeatLog &&other) noexcept
+        :layout(other.layout), fd(other.fd), map(other.map), capacity(other.capacity), num_records(other.num_records)
+    {
+        other.fd = -1;
+        other.map = nullptr;
+    }
+
+    AxisBeatLog(const AxisBeatLog &) = delete;
+    AxisBeatLog &operator=(const AxisBeatLog &) = delete;
+
+    ~AxisBeatLog()
+    {
+        if(fd < 0)
+        {
+            return;
+        }
+
+        // Trim the spare space that was reserved for future records
+        // If this fails the spare space is left on the end, which is harmless as the header says how many records are valid
+        munmap(map, capacity);
+        int ret = ftruncate(fd, sizeof(AxisBeatLogHeader) + num_records * layout.record_bytes);
+        static_cast<void>(ret);
+        ::close(fd);
+    }
+
+    template <class dataT, class keepT, class userT, size_t n_users> void append(uint64_t time, const dataT &tdata, const keepT &tkeep, bool tlast, const std::array<userT, n_users> &tusers)
+    {
+        if(sizeof(dataT) != layout.data_bytes || sizeof(keepT) != layout.keep_bytes || n_users != layout.n_users || (n_users && sizeof(userT) != layout.user_bytes))
+        {
+            throw AxisBeatLogException("AXIS beat log was created for a different interface to the one being logged");
+        }
+
+        size_t offset = sizeof(AxisBeatLogHeader) + num_records * layout.record_bytes;
+        if(offset + layout.record_bytes > capacity)
+        {
+            resize(capacity * 2);
+        }
+
+        char *record = static_cast<char *>(map) + offset;
+        memcpy(record, &time, sizeof(time));
+        memcpy(record + layout.data_offset, &tdata, sizeof(dataT));
+        memcpy(record + layout.keep_offset, &tkeep, sizeof(keepT));
+        for(size_t i=0; i < n_users; i++)
+        {
+            memcpy(record + layout.user_offset + i * sizeof(userT), &tusers[i], sizeof(userT));
+        }
+        record[layout.last_offset] = tlast;
+
+        getHeader()->num_records = ++num_records;
+    }
+
+    uint64_t getNumRecords(void) const {return num_records;};
+
+    // Record what the times are in, so that converted logs line up with traces. AXISSource, AXISSink and AXISMonitor set it from their clock
+    void setResolution(double seconds) {getHeader()->resolution = seconds;};
+
+private:
+    static constexpr size_t initial_capacity = 1 << 20;
+
+    const AxisBeatLogLayout layout;
+    int fd = -1;
+    void *map = nullptr;
+    size_t capacity = 0;
+    uint64_t num_records = 0;
+
+    AxisBeatLogHeader *getHeader(void) {return static_cast<AxisBeatLogHeader *>(map);};
+
+    void resize(size_t new_capacity)
+    {
+        if(ftruncate(fd, new_capacity) != 0)
+        {
+            throw AxisBeatLogException(std::string("Couldn't grow AXIS beat log: ") + strerror(errno));
+        }
+
+        void *new_map = map ? mremap(map, capacity, new_capacity, MREMAP_MAYMOVE) : mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(new_map == MAP_FAILED)
+        {
+            throw AxisBeatLogException(std::string("Couldn't map AXIS beat log: ") + strerror(errno));
+        }
+        map = new_map;
+        capacity = new_capacity;
+    }
+};
+
+// Read back a log written by AxisBeatLog
+class AxisBeatLogReader
+{
+public:
+    AxisBeatLogReader(const std::string &filename)
+    {
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            throw AxisBeatLogException("Couldn't open AXIS beat log " + filename + ": " + strerror(errno));
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(AxisBeatLogHeader))
+        {
+            ::close(fd);
+            throw AxisBeatLogException(filename + " is too short to be an AXIS beat log");
+        }
+        size = st.st_size;
+
+        map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED)
+        {
+            ::close(fd);
+            throw AxisBeatLogException(std::string("Couldn't map AXIS beat log: ") + strerror(errno));
+        }
+
+        const auto *header = static_cast<const AxisBeatLogHeader *>(map);
+        if(memcmp(header->magic, AxisBeatLogHeader::expected_magic, sizeof(header->magic)) != 0 || header->version != AxisBeatLogHeader::expected_version)
+        {
+            close();
+            throw AxisBeatLogException(filename + " is not an AXIS beat log, or is from an unsupported version");
+        }
+
+        layout.emplace(header->data_bytes, header->keep_bytes, header->user_bytes, header->n_users);
+        if(layout->record_bytes != header->record_bytes)
+        {
+            close();
+            throw AxisBeatLogException(filename + " has an inconsistent record size");
+        }
+
+        resolution = header->resolution;
+        // Don't trust the count further than the file actually goes
+        num_records = std::min<uint64_t>(header->num_records, (size - sizeof(AxisBeatLogHeader)) / header->record_bytes);
+    }
+
+    AxisBeatLogReader(const AxisBeatLogReader &) = delete;
+    AxisBeatLogReader &operator=(const AxisBeatLogReader &) = delete;
+
+    ~AxisBeatLogReader()
+    {
+        close();
+    }
+
+    const AxisBeatLogLayout &getLayout(void) const {return *layout;};
+    uint64_t getNumRecords(void) const {return num_records;};
+    // Seconds per tick of getTime(), or 0 if it wasn't recorded
+    double getResolution(void) const {return resolution;};
+
+    uint64_t getTime(uint64_t i) const
+    {
+        uint64_t time;
+        memcpy(&time, record(i), sizeof(time));
+        return time;
+    }
+    bool getLast(uint64_t i) const {return record(i)[layout->last_offset];};
+    // Byte pointers, least significant byte first
+    const uint8_t *getData(uint64_t i) const {return record(i) + layout->data_offset;};
+    const uint8_t *getKeep(uint64_t i) const {return record(i) + layout->keep_offset;};
+    const uint8_t *getUser(uint64_t i, uint32_t user) const {return record(i) + layout->user_offset + user * layout->user_bytes;};
+
+private:
+    int fd = -1;
+    void *map = nullptr;
+    size_t size = 0;
+    std::optional<AxisBeatLogLayout> layout;
+    uint64_t num_records = 0;
+    double resolution = 0;
+
+    const uint8_t *record(uint64_t i) const
+    {
+        return static_cast<const uint8_t *>(map) + sizeof(AxisBeatLogHeader) + i * layout->record_bytes;
+    }
+
+    void close(void)
+    {
+        if(map)
+        {
+            munmap(map, size);
+            map = nullptr;
+        }
+        if(fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,130 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef AXIS_FLOW_CONTROL_HPP
+#define AXIS_FLOW_CONTROL_HPP
+
+// Traffic shaping for AXIS peripherals, which decides each cycle whether a source may assert tvalid, or a sink tready
+// It is a value type, so each peripheral gets its own copy (and state) from its config
+// The randomness comes from the peripheral's own seeded SimRandom, so results are reproducible
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "../other/SimRandom.hpp"
+
+class AxisFlowControl
+{
+public:
+    // Never stall (the default)
+    static AxisFlowControl always(void) {return AxisFlowControl(Mode::ALWAYS);};
+
+    // Allowed on each cycle independently, with probability on_fraction
+    static AxisFlowControl dutyCycle(double on_fraction)
+    {
+        checkProbability(on_fraction);
+        AxisFlowControl ret(Mode::DUTY_CYCLE);
+        ret.p_a = on_fraction;
+        return ret;
+    }
+
+    // Bursty on/off. Each cycle an on stream turns off with probability p_stall, and an off stream back on with probability p_resume
+    // So bursts average 1/p_stall cycles, and stalls 1/p_resume
+    static AxisFlowControl markov(double p_stall, double p_resume)
+    {
+        checkProbability(p_stall);
+        checkProbability(p_resume);
+        if(p_resume == 0) throw std::invalid_argument("Markov flow control would never resume");
+        AxisFlowControl ret(Mode::MARKOV);
+        ret.p_a = p_stall;
+        ret.p_b = p_resume;
+        return ret;
+    }
+
+    // Repeat a fixed pattern of allowed (true) and stalled (false) cycles
+    static AxisFlowControl pattern(std::vector<bool> on_cycles)
+    {
+        if(on_cycles.empty()) throw std::invalid_argument("Flow control pattern is empty");
+        AxisFlowControl ret(Mode::PATTERN);
+        ret.on_pattern = std::move(on_cycles);
+        return ret;
+    }
+
+    // Average of rate beats per cycle, with bursts of up to burst beats once it has been idle
+    static AxisFlowControl tokenBucket(double rate, double burst=1)
+    {
+        if(rate <= 0 || rate > 1) throw std::invalid_argument("Token bucket rate must be in (0, 1] beats per cycle");
+        if(burst < 1) throw std::invalid_argument("Token bucket burst must be at least 1 beat");
+        AxisFlowControl ret(Mode::TOKEN_BUCKET);
+        ret.p_a = rate;
+        ret.p_b = burst;
+        ret.tokens = burst;
+        return ret;
+    }
+
+    // Call once per cycle, returns whether a beat may be transferred this cycle
+    bool allow(SimRandom &random)
+    {
+        switch(mode)
+        {
+            case Mode::ALWAYS:
+                return true;
+            case Mode::DUTY_CYCLE:
+                return random.nextDouble() < p_a;
+            case Mode::MARKOV:
+                on = on ? !(random.nextDouble() < p_a) : (random.nextDouble() < p_b);
+                return on;
+            case Mode::PATTERN:
+            {
+                bool ret = on_pattern[pattern_pos++];
+                if(pattern_pos == on_pattern.size())
+                {
+                    pattern_pos = 0;
+                }
+                return ret;
+            }
+            case Mode::TOKEN_BUCKET:
+                tokens = std::min(tokens + p_a, p_b);
+                return tokens >= 1;
+        }
+        return true;
+    }
+
+    // Call when a beat is actually transferred
+    void used(void)
+    {
+        if(mode == Mode::TOKEN_BUCKET)
+        {
+            tokens -= 1;
+        }
+    }
+
+private:
+    enum class Mode {ALWAYS, DUTY_CYCLE, MARKOV, PATTERN, TOKEN_BUCKET};
+
+    explicit AxisFlowControl(Mode mode_) :mode(mode_) {};
+
+    Mode mode;
+    // Meaning depends on the mode, see the factory functions
+    double p_a = 0;
+    double p_b = 0;
+
+    bool on = true;
+    std::vector<bool> on_pattern;
+    size_t pattern_pos = 0;
+    double tokens = 0;
+
+    static void checkProbability(double p)
+    {
+        if(p < 0 || p > 1) throw std::invalid_argument("Flow control probability must be in [0, 1]");
+    }
+};
+
+#endif
@@ -0,0 +1,147 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef LATENCY_TRACKER_HPP
+#define LATENCY_TRACKER_HPP
+
+// Measure the latency of packets through a block, from the first beat being accepted at the input to tlast at the output
+// Pass the same tracker to an AXISSource and an AXISSink (via their configs)
+// Each packet sent is given an ID and stamped with the time. Received packets are matched to them either in order,
+// or by a key pulled out of the packet, for blocks that reorder or modify packets (e.g. a sequence number in the payload)
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <gsl/pointers>
+
+#include "../other/ClockGen.hpp"
+#include "../other/Metrics.hpp"
+#include "../verilator/VerilatedModel.hpp"
+
+struct LatencyTrackerException : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct LatencyTrackerConfig
+{
+    // If set, received packets are matched to the oldest sent packet with the same key, rather than in order
+    // The key has to be the same at both ends, so must come from a part of the packet that the block doesn't change
+    std::function<uint64_t(std::span<const uint8_t>)> key;
+};
+
+class LatencyTracker
+{
+public:
+    // Latencies are measured in cycles of clk
+    LatencyTracker(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, LatencyTrackerConfig config_=LatencyTrackerConfig{})
+        :clk(clk_), config(std::move(config_)),
+         metrics(model->getMetrics().instanceScope("LatencyTracker")),
+         latency_histogram(metrics.histogram("latency_cycles")),
+         sent_counter(metrics.counter("sent")),
+         received_counter(metrics.counter("received")),
+         unmatched_counter(metrics.counter("unmatched"))
+    {
+    }
+
+    // Called by the source when the first beat of a packet is accepted. Returns the ID given to the packet
+    uint64_t packetSent(vluint64_t time, std::span<const uint8_t> packet)
+    {
+        uint64_t id = next_id++;
+        sent_counter.increment();
+        if(config.key)
+        {
+            outstanding_by_key[config.key(packet)].push_back(Stamp{id, time});
+        } else {
+            outstanding.push_back(Stamp{id, time});
+        }
+        num_outstanding++;
+        return id;
+    }
+
+    // Called by the sink on tlast. Returns the ID of the matching sent packet, if there is one
+    std::optional<uint64_t> packetReceived(vluint64_t time, std::span<const uint8_t> packet)
+    {
+        received_counter.increment();
+
+        Stamp stamp;
+        if(config.key)
+        {
+            auto iter = outstanding_by_key.find(config.key(packet));
+            if(iter == outstanding_by_key.end())
+            {
+                unmatched_counter.increment();
+                return std::nullopt;
+            }
+            stamp = iter->second.front();
+            iter->second.pop_front();
+            if(iter->second.empty())
+            {
+                outstanding_by_key.erase(iter);
+            }
+        } else {
+            if(outstanding.empty())
+            {
+                unmatched_counter.increment();
+                return std::nullopt;
+            }
+            stamp = outstanding.front();
+            outstanding.pop_front();
+        }
+        num_outstanding--;
+
+        if(time < stamp.time)
+        {
+            throw LatencyTrackerException("Packet received before it was sent, are the source and sink the right way round?");
+        }
+        latency_histogram.add(static_cast<double>(time - stamp.time) / clk->getTicksPerClock());
+        return stamp.id;
+    }
+
+    // Latency statistics in cycles. Only meaningful once a packet has been received
+    double getMin(void) const {return latency_histogram.getMin();};
+    double getMax(void) const {return latency_histogram.getMax();};
+    double getMean(void) const {return latency_histogram.getMean();};
+    double getPercentile(double p) const {return latency_histogram.getPercentile(p);};
+    const MetricsHistogram &getHistogram(void) const {return latency_histogram;};
+
+    vluint64_t getNumSent(void) const {return sent_counter.get();};
+    vluint64_t getNumReceived(void) const {return received_counter.get();};
+    // Received packets that didn't match anything that had been sent
+    vluint64_t getNumUnmatched(void) const {return unmatched_counter.get();};
+    // Sent packets that haven't been received (yet)
+    size_t getNumOutstanding(void) const {return num_outstanding;};
+
+private:
+    struct Stamp
+    {
+        uint64_t id;
+        vluint64_t time;
+    };
+
+    ClockGen *clk;
+    LatencyTrackerConfig config;
+
+    uint64_t next_id = 0;
+    std::deque<Stamp> outstanding;
+    std::unordered_map<uint64_t, std::deque<Stamp>> outstanding_by_key;
+    size_t num_outstanding = 0;
+
+    MetricsScope metrics;
+    MetricsHistogram &latency_histogram;
+    MetricsCounter &sent_counter;
+    MetricsCounter &received_counter;
+    MetricsCounter &unmatched_counter;
+};
+
+#endif
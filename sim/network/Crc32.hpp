@@ -0,0 +1,198 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef CRC32_HPP
+#define CRC32_HPP
+
+// Reference model for the ethernet CRC (IEEE 802.3 CRC-32), as calculated by eth_crc.sv
+// Gives the same values as zlib's crc32, so update(0, data) is the FCS of a frame, and a running CRC can be carried
+// from one piece of data to the next, e.g. to cover the padding after the data without copying it
+// Uses carry-less multiplication to fold 64 bytes at a time on CPUs that have it, and slice-by-16 tables otherwise
+// (and for short data, where setting up the folding costs more than it saves)
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Crc32
+{
+    enum class Implementation
+    {
+        SLICE_BY_16,
+        // Carry-less multiply (PCLMULQDQ). Falls back to SLICE_BY_16 for anything shorter than 64 bytes
+        PCLMUL
+    };
+
+    namespace detail
+    {
+        // Bit reversed 0x04C11DB7
+        constexpr uint32_t polynomial = 0xEDB88320;
+
+        // tables[0] is the usual byte at a time table. tables[k] advances a byte's contribution by k more bytes of zeros
+        constexpr std::array<std::array<uint32_t, 256>, 16> makeTables(void)
+        {
+            std::array<std::array<uint32_t, 256>, 16> tables{};
+            for(uint32_t i=0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for(int bit=0; bit < 8; bit++)
+                {
+                    crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+                }
+                tables[0][i] = crc;
+            }
+            for(size_t k=1; k < 16; k++)
+            {
+                for(size_t i=0; i < 256; i++)
+                {
+                    tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+                }
+            }
+            return tables;
+        }
+
+        inline constexpr auto tables = makeTables();
+
+        inline uint32_t load32(const uint8_t *p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            if constexpr(std::endian::native == std::endian::big)
+            {
+                value = __builtin_bswap32(value);
+            }
+            return value;
+        }
+
+        // crc is the register, i.e. already inverted
+        inline uint32_t sliceBy16(uint32_t crc, const uint8_t *p, size_t n)
+        {
+            const auto &t = tables;
+            for(; n >= 16; p += 16, n -= 16)
+            {
+                uint32_t a = load32(p) ^ crc;
+                uint32_t b = load32(p + 4);
+                uint32_t c = load32(p + 8);
+                uint32_t d = load32(p + 12);
+                crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24] ^
+                      t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24] ^
+                      t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24] ^
+                      t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24];
+            }
+            for(; n; p++, n--)
+            {
+                crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+            }
+            return crc;
+        }
+
+#if defined(__x86_64__)
+        // Multiply the two halves of x by the two constants in k, to move them 128 bits (or 512 bits) further on, and add them to next
+        __attribute__((target("pclmul,sse4.1"))) inline __m128i fold(__m128i x, __m128i k, __m128i next)
+        {
+            return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next);
+        }
+
+        __attribute__((target("sse4.1"))) inline __m128i load(const uint8_t *p)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        }
+
+        // Fold 4x128 bits at a time, then down to 128 bits, then Barrett reduce to 32 bits
+        // From Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", with the bit reflected constants
+        // n must be a multiple of 16, and at least 64. crc is the register, i.e. already inverted
+        __attribute__((target("pclmul,sse4.1"))) inline uint32_t pclmul(uint32_t crc, const uint8_t *p, size_t n)
+        {
+            const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+            const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+            const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+            const __m128i barrett = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+            const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+            __m128i x1 = _mm_xor_si128(load(p), _mm_cvtsi32_si128(static_cast<int>(crc)));
+            __m128i x2 = load(p + 16);
+            __m128i x3 = load(p + 32);
+            __m128i x4 = load(p + 48);
+            p += 64;
+            n -= 64;
+
+            for(; n >= 64; p += 64, n -= 64)
+            {
+                x1 = fold(x1, k1k2, load(p));
+                x2 = fold(x2, k1k2, load(p + 16));
+                x3 = fold(x3, k1k2, load(p + 32));
+                x4 = fold(x4, k1k2, load(p + 48));
+            }
+
+            x1 = fold(x1, k3k4, x2);
+            x1 = fold(x1, k3k4, x3);
+            x1 = fold(x1, k3k4, x4);
+            for(; n >= 16; p += 16, n -= 16)
+            {
+                x1 = fold(x1, k3k4, load(p));
+            }
+
+            // 128 bits down to 64
+            x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+            x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+            x2 = _mm_srli_si128(x1, 4);
+            x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), x2);
+
+            // Barrett reduction down to 32
+            x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), barrett, 0x10);
+            x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), barrett, 0x00);
+            x1 = _mm_xor_si128(x1, x2);
+            return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+        }
+#endif
+    }
+
+    // The fastest implementation this CPU supports. Checked once
+    inline Implementation fastest(void)
+    {
+#if defined(__x86_64__)
+        static const Implementation best = (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) ? Implementation::PCLMUL : Implementation::SLICE_BY_16;
+        return best;
+#else
+        return Implementation::SLICE_BY_16;
+#endif
+    }
+
+    // Continue crc (the result of a previous call, or 0 to start) over data
+    // implementation should normally be left alone. Asking for one the CPU doesn't support is undefined
+    inline uint32_t update(uint32_t crc, std::span<const uint8_t> data, [[maybe_unused]] Implementation implementation=fastest())
+    {
+        const uint8_t *p = data.data();
+        size_t n = data.size();
+        crc = ~crc;
+#if defined(__x86_64__)
+        if(implementation == Implementation::PCLMUL && n >= 64)
+        {
+            size_t folded = n & ~size_t(15);
+            crc = detail::pclmul(crc, p, folded);
+            p += folded;
+            n -= folded;
+        }
+#endif
+        return ~detail::sliceBy16(crc, p, n);
+    }
+
+    inline uint32_t compute(std::span<const uint8_t> data)
+    {
+        return update(0, data);
+    }
+}
+
+#endif
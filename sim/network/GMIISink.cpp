@@ -1,7 +1,7 @@
 #include "GMIISink.hpp"
+#include "Crc32.hpp"
 
 #include <sstream>
-#include <zlib.h>
 #include <iostream>
 
 void GMIISink::eval(void)
@@ -16,10 +16,12 @@ void GMIISink::eval(void)
         if(eth_txer)
         {
             // There was a line error, clear out the packet, but don't send to sink
+            line_error_counter.increment();
             current_packet.clear();
         } else if(eth_txen) {
             if(ipg_counter)
             {
+                ipg_violation_counter.increment();
                 GMIISinkException("Violation of inter packet gap. " + std::to_string(ipg_counter)+" cycles remain");
             }
 
@@ -55,7 +57,7 @@ void GMIISink::eval(void)
                 throw GMIISinkException("Packet is too small");
             }
 
-            uint32_t crc_calc = crc32(0x0, &(*iter), current_packet.end()-iter-4);
+            uint32_t crc_calc = Crc32::compute(std::span(iter, current_packet.end() - 4));
             uint32_t crc_hdl = *reinterpret_cast<uint32_t *>(&(*(current_packet.end()-4)));
             if(crc_calc != crc_hdl)
             {
@@ -67,6 +69,8 @@ void GMIISink::eval(void)
             }
 
             data_sink->send(std::span(iter, current_packet.end())); // Send CRC as well. Wireshark will check it for us :)
+            packets_counter.increment();
+            bytes_counter.increment(current_packet.end() - iter);
 
             current_packet.clear();
             ipg_counter = 12;
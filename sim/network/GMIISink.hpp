@@ -15,7 +15,6 @@
 #include "../verilator/Peripheral.hpp"
 #include "../verilator/VerilatedModel.hpp"
 #include "../other/PacketSourceSink.hpp"
-#include <zlib.h>
 
 class GMIISinkException : public std::runtime_error
 {
@@ -26,7 +25,12 @@ class GMIISink : public Peripheral
 {
 public:
     GMIISink(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, gsl::not_null<vluint8_t *>eth_txd_, gsl::not_null<vluint8_t *>eth_txen_, gsl::not_null<vluint8_t *>eth_txer_, gsl::not_null<PacketSink<vluint8_t> *> data_sink_)
-		:Peripheral(model), clk(clk_), eth_txd(this, eth_txd_), eth_txen(this, eth_txen_), eth_txer(this, eth_txer_), data_sink(data_sink_)
+		:Peripheral(model), clk(clk_), eth_txd(this, eth_txd_), eth_txen(this, eth_txen_), eth_txer(this, eth_txer_), data_sink(data_sink_),
+		 metrics(model->getMetrics().instanceScope("GMIISink")),
+		 packets_counter(metrics.counter("packets")),
+		 bytes_counter(metrics.counter("bytes")),
+		 line_error_counter(metrics.counter("line_errors")),
+		 ipg_violation_counter(metrics.counter("ipg_violations"))
 	{
         current_packet.reserve(1538); // Standard MTU
 	};
@@ -44,6 +48,12 @@ private:
     std::vector<uint8_t> current_packet;
 
     unsigned int ipg_counter{0};
+
+    MetricsScope metrics;
+    MetricsCounter &packets_counter;
+    MetricsCounter &bytes_counter;
+    MetricsCounter &line_error_counter;
+    MetricsCounter &ipg_violation_counter;
 };
 
 #endif
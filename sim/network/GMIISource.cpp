@@ -1,7 +1,6 @@
 #include "GMIISource.hpp"
 
-#include <boost/endian/conversion.hpp>
-#include <zlib.h>
+#include "Crc32.hpp"
 
 void GMIISource::eval(void)
 {
@@ -12,30 +11,28 @@ void GMIISource::eval(void)
         eth_rxer = 0;
 
         // If we have run out of data, try and get more
-        if (iter == current_packet.end())
+        if (frame_pos == frame_len)
         {
-            auto maybe_new_packet = data_source->receive();
-            if (maybe_new_packet)
+            current_packet.reset();
+            current_packet = data_source.lease();
+            if (current_packet)
             {
-                current_packet = *maybe_new_packet;
+                packets_counter.increment();
+                bytes_counter.increment(current_packet->size());
 
                 // Pad if less than minimum size
-                if (current_packet.size() < 60)
-                {
-                    // Pad with zeros, even though actual value does not matter
-                    current_packet.resize(60, 0);
-                }
+                // Pad with zeros, even though actual value does not matter
+                size_t pad_len = (current_packet->size() < min_frame_size) ? min_frame_size - current_packet->size() : 0;
+                static constexpr std::array<uint8_t, min_frame_size> zeros{};
 
-                // Add the ethernet CRC to the front
-                uint32_t crc = crc32(0, current_packet.data(), current_packet.size());
-                boost::endian::native_to_big_inplace(crc);
-                auto crc_u8_ptr = reinterpret_cast<uint8_t *>(&crc);
-                std::copy(crc_u8_ptr, crc_u8_ptr + 4, std::back_inserter(current_packet));
+                // The ethernet CRC covers the data and the padding
+                crc = Crc32::update(0, current_packet->span());
+                crc = Crc32::update(crc, std::span(zeros.data(), pad_len));
 
-                // Put preamble on the front
-                current_packet.insert(current_packet.begin(), preamble.begin(), preamble.end());
-
-                iter = current_packet.begin();
+                data_end = preamble.size() + current_packet->size();
+                pad_end = data_end + pad_len;
+                frame_len = pad_end + 4;
+                frame_pos = 0;
             }
         }
 
@@ -45,12 +42,12 @@ void GMIISource::eval(void)
             ipg_counter--;
         } else {
             // If we have data to give, present that
-            if (iter != current_packet.end())
+            if (frame_pos != frame_len)
             {
                 eth_rxdv = 1;
-                eth_rxd = *(iter++);
+                eth_rxd = frameByte(frame_pos++);
 
-                if (iter == current_packet.end())
+                if (frame_pos == frame_len)
                 {
                     ipg_counter = 12;
                 }
@@ -59,3 +56,17 @@ void GMIISource::eval(void)
     }
 }
 
+uint8_t GMIISource::frameByte(size_t pos) const
+{
+    if (pos < preamble.size())
+    {
+        return preamble[pos];
+    } else if (pos < data_end) {
+        return current_packet->data()[pos - preamble.size()];
+    } else if (pos < pad_end) {
+        return 0;
+    } else {
+        // CRC goes out most significant byte first
+        return static_cast<uint8_t>(crc >> (8 * (3 - (pos - pad_end))));
+    }
+}
@@ -13,13 +13,17 @@
 #include <vector>
 #include "../other/ClockGen.hpp"
 #include "../verilator/Peripheral.hpp"
-#include "../other/PacketSourceSink.hpp"
+#include "../verilator/VerilatedModel.hpp"
+#include "../other/PacketLease.hpp"
 
 class GMIISource : public Peripheral
 {
 public:
-    GMIISource(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, gsl::not_null<vluint8_t *>eth_rxd_, gsl::not_null<vluint8_t *>eth_rxdv_, gsl::not_null<vluint8_t *>eth_rxer_, gsl::not_null<PacketSource<vluint8_t> *> data_source_)
-		:Peripheral(model), clk(clk_), eth_rxd(eth_rxd_), eth_rxdv(eth_rxdv_), eth_rxer(eth_rxer), data_source(data_source_)
+    GMIISource(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, gsl::not_null<vluint8_t *>eth_rxd_, gsl::not_null<vluint8_t *>eth_rxdv_, gsl::not_null<vluint8_t *>eth_rxer_, AnyPacketSource<vluint8_t> data_source_)
+		:Peripheral(model), clk(clk_), eth_rxd(eth_rxd_), eth_rxdv(eth_rxdv_), eth_rxer(eth_rxer_), data_source(std::move(data_source_)),
+		 metrics(model->getMetrics().instanceScope("GMIISource")),
+		 packets_counter(metrics.counter("packets")),
+		 bytes_counter(metrics.counter("bytes"))
 	{
         eth_rxd = 0;
         eth_rxdv = 0;
@@ -34,13 +38,24 @@ private:
     OutputWrapper<vluint8_t> eth_rxdv;
     OutputWrapper<vluint8_t> eth_rxer;
 
-    PacketSource<uint8_t> *data_source;
+    // The frame is streamed straight out of the leased packet, with the preamble, padding and CRC added on the fly
+    AnyPacketSource<uint8_t> data_source;
+    std::optional<PacketLease<uint8_t>> current_packet;
+    size_t frame_pos = 0;
+    size_t frame_len = 0;
+    size_t data_end = 0;
+    size_t pad_end = 0;
+    uint32_t crc = 0;
 
-    std::vector<uint8_t> current_packet;
-    typename std::vector<uint8_t>::const_iterator iter = current_packet.end();
+    uint8_t frameByte(size_t pos) const;
 
     unsigned int ipg_counter{0};
 
+    MetricsScope metrics;
+    MetricsCounter &packets_counter;
+    MetricsCounter &bytes_counter;
+
+    static constexpr size_t min_frame_size = 60;
     static constexpr std::array<uint8_t,8> preamble = {0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0xD5};
 };
 
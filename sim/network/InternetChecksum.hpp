@@ -0,0 +1,177 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef INTERNET_CHECKSUM_HPP
+#define INTERNET_CHECKSUM_HPP
+
+// Reference model for the ones' complement sum used by the IP, UDP and TCP checksums (RFC 1071), as calculated by ip_checksum.sv
+// Sums are kept as numbers, as if the data were big endian 16 bit words, so header fields can be added to them directly
+// The ones' complement sum doesn't depend on byte order, so the data is summed in the native order, 32 or 16 bytes at a time
+// with AVX2 or SSE2, and only the result swapped
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace InternetChecksum
+{
+    namespace detail
+    {
+        inline uint64_t fold16(uint64_t sum)
+        {
+            while(sum >> 16)
+            {
+                sum = (sum & 0xFFFF) + (sum >> 16);
+            }
+            return sum;
+        }
+
+        // Sum of data as native 16 bit words, with a trailing odd byte padded with zero. Not folded
+        inline uint64_t nativeSum(const uint8_t *p, size_t n)
+        {
+            uint64_t sum = 0;
+            for(; n >= 4; p += 4, n -= 4)
+            {
+                uint32_t word;
+                memcpy(&word, p, sizeof(word));
+                sum += word;
+            }
+            if(n >= 2)
+            {
+                uint16_t word;
+                memcpy(&word, p, sizeof(word));
+                sum += word;
+                p += 2;
+                n -= 2;
+            }
+            if(n)
+            {
+                // The byte comes first in its word, so is the low byte on a little endian machine
+                sum += (std::endian::native == std::endian::little) ? p[0] : (p[0] << 8);
+            }
+            return sum;
+        }
+
+#if defined(__x86_64__)
+        // Each 32 bit lane gains at most 2 * 0xFFFF per vector, so widen into the 64 bit sum before the lanes can overflow
+        constexpr size_t vectors_per_widen = 1 << 14;
+
+        // SSE2 is always there on x86-64
+        inline uint64_t nativeSumSse2(const uint8_t *p, size_t n)
+        {
+            const __m128i low16 = _mm_set1_epi32(0xFFFF);
+            __m128i sum64 = _mm_setzero_si128();
+            while(n >= 16)
+            {
+                __m128i sum32 = _mm_setzero_si128();
+                for(size_t i=0; i < vectors_per_widen && n >= 16; i++, p += 16, n -= 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                    sum32 = _mm_add_epi32(sum32, _mm_add_epi32(_mm_and_si128(v, low16), _mm_srli_epi32(v, 16)));
+                }
+                sum64 = _mm_add_epi64(sum64, _mm_add_epi64(_mm_unpacklo_epi32(sum32, _mm_setzero_si128()), _mm_unpackhi_epi32(sum32, _mm_setzero_si128())));
+            }
+            uint64_t lanes[2];
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum64);
+            return lanes[0] + lanes[1] + nativeSum(p, n);
+        }
+
+        __attribute__((target("avx2"))) inline uint64_t nativeSumAvx2(const uint8_t *p, size_t n)
+        {
+            const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+            __m256i sum64 = _mm256_setzero_si256();
+            while(n >= 64)
+            {
+                // Two vectors a time, so each accumulator only has half as many to add before widening
+                __m256i sum32a = _mm256_setzero_si256();
+                __m256i sum32b = _mm256_setzero_si256();
+                for(size_t i=0; i < vectors_per_widen && n >= 64; i++, p += 64, n -= 64)
+                {
+                    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+                    sum32a = _mm256_add_epi32(sum32a, _mm256_add_epi32(_mm256_and_si256(a, low16), _mm256_srli_epi32(a, 16)));
+                    sum32b = _mm256_add_epi32(sum32b, _mm256_add_epi32(_mm256_and_si256(b, low16), _mm256_srli_epi32(b, 16)));
+                }
+                __m256i zero = _mm256_setzero_si256();
+                sum64 = _mm256_add_epi64(sum64, _mm256_add_epi64(_mm256_unpacklo_epi32(sum32a, zero), _mm256_unpackhi_epi32(sum32a, zero)));
+                sum64 = _mm256_add_epi64(sum64, _mm256_add_epi64(_mm256_unpacklo_epi32(sum32b, zero), _mm256_unpackhi_epi32(sum32b, zero)));
+            }
+            uint64_t lanes[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), sum64);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + nativeSumSse2(p, n);
+        }
+#endif
+
+        // Sum of data as big endian 16 bit words, folded to 16 bits
+        inline uint16_t sum(std::span<const uint8_t> data)
+        {
+#if defined(__x86_64__)
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            uint64_t native = avx2 ? nativeSumAvx2(data.data(), data.size()) : nativeSumSse2(data.data(), data.size());
+#else
+            uint64_t native = nativeSum(data.data(), data.size());
+#endif
+            uint16_t folded = static_cast<uint16_t>(fold16(native));
+            return (std::endian::native == std::endian::little) ? __builtin_bswap16(folded) : folded;
+        }
+    }
+
+    // Add data to a running sum, as big endian 16 bit words. An odd length is padded with a zero byte,
+    // so only the last piece of data added to a sum can have an odd length. Use Accumulator to add data in arbitrary pieces
+    inline uint64_t add(uint64_t sum, std::span<const uint8_t> data)
+    {
+        return sum + detail::sum(data);
+    }
+
+    // Fold a sum down to 16 bits and complement it, ready to go in a header
+    inline uint16_t finish(uint64_t sum)
+    {
+        return static_cast<uint16_t>(~detail::fold16(sum));
+    }
+
+    inline uint16_t compute(std::span<const uint8_t> data)
+    {
+        return finish(add(0, data));
+    }
+
+    // Checksum data that arrives in pieces of any length, e.g. beat by beat from a sink
+    class Accumulator
+    {
+    public:
+        void add(std::span<const uint8_t> data)
+        {
+            uint64_t piece = detail::sum(data);
+            // After an odd number of bytes, this piece's words straddle the ones that were summed, so its bytes are the other way round
+            // Swapping bytes commutes with the ones' complement sum, so swap the piece's sum rather than the data
+            if(odd)
+            {
+                piece = __builtin_bswap16(static_cast<uint16_t>(piece));
+            }
+            sum += piece;
+            odd ^= data.size() & 1;
+        }
+
+        // For adding header fields, e.g. a pseudo header, as if they were two more bytes of data
+        void addWord(uint16_t word) {sum += odd ? __builtin_bswap16(word) : word;};
+
+        uint64_t getSum(void) const {return sum;};
+        uint16_t finish(void) const {return InternetChecksum::finish(sum);};
+
+    private:
+        uint64_t sum = 0;
+        bool odd = false;
+    };
+}
+
+#endif
@@ -0,0 +1,477 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef PACKET_BUILDER_HPP
+#define PACKET_BUILDER_HPP
+
+// Build Ethernet, ARP, IPv4, UDP and TCP packets for stimulus, rather than assembling headers by hand
+// Layers are added outermost first, then finish() fills in the lengths, checksums, ethertype and IP protocol
+// e.g. PacketBuilder(packet).ethernet({.dst = ..., .src = ...}).ipv4({.src = ..., .dst = ...}).udp({.src_port = 1, .dst_port = 2}).payload(data).finish();
+// Packets are built into an existing vector, so building into pooled buffers (e.g. from GeneratorPacketSource::receivePooled)
+// doesn't allocate once the buffers have grown
+// Addresses and fields are given in host order, e.g. 192.168.0.1 is 0xC0A80001, and written out in network order
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "InternetChecksum.hpp"
+#include "../other/GeneratorPacketSource.hpp"
+#include "../other/SimRandom.hpp"
+
+struct PacketBuilderException : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct MacAddress
+{
+    std::array<uint8_t, 6> bytes{};
+
+    // Most significant byte first, so 0x020000000001 is 02:00:00:00:00:01
+    static constexpr MacAddress fromUint64(uint64_t value)
+    {
+        MacAddress ret;
+        for(size_t i=0; i < 6; i++)
+        {
+            ret.bytes[i] = static_cast<uint8_t>(value >> (8 * (5 - i)));
+        }
+        return ret;
+    }
+
+    static constexpr MacAddress broadcast(void) {return fromUint64(0xFFFFFFFFFFFF);};
+
+    bool operator==(const MacAddress &) const = default;
+};
+
+constexpr uint32_t ipv4Address(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+    return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+}
+
+namespace EtherType
+{
+    constexpr uint16_t IPV4 = 0x0800;
+    constexpr uint16_t ARP = 0x0806;
+}
+
+namespace IpProtocol
+{
+    constexpr uint8_t TCP = 6;
+    constexpr uint8_t UDP = 17;
+}
+
+namespace TcpFlags
+{
+    constexpr uint8_t FIN = 0x01;
+    constexpr uint8_t SYN = 0x02;
+    constexpr uint8_t RST = 0x04;
+    constexpr uint8_t PSH = 0x08;
+    constexpr uint8_t ACK = 0x10;
+    constexpr uint8_t URG = 0x20;
+}
+
+struct EthernetHeader
+{
+    MacAddress dst = {};
+    MacAddress src = {};
+    // Filled in from the next layer if not given
+    std::optional<uint16_t> ethertype = std::nullopt;
+};
+
+struct ArpHeader
+{
+    enum Operation : uint16_t {REQUEST = 1, REPLY = 2};
+
+    uint16_t operation = REQUEST;
+    MacAddress sender_mac = {};
+    uint32_t sender_ip = 0;
+    MacAddress target_mac = {};
+    uint32_t target_ip = 0;
+};
+
+struct Ipv4Header
+{
+    uint32_t src = 0;
+    uint32_t dst = 0;
+    // Filled in from the next layer if not given
+    std::optional<uint8_t> protocol = std::nullopt;
+    uint8_t tos = 0;
+    uint16_t identification = 0;
+    bool dont_fragment = true;
+    uint8_t ttl = 64;
+    // Padded with zeros (end of options) to a multiple of 4 bytes. At most 40 bytes
+    std::span<const uint8_t> options = {};
+};
+
+struct UdpHeader
+{
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    // Otherwise the checksum is left as zero, meaning there isn't one
+    bool checksum = true;
+};
+
+struct TcpHeader
+{
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    uint32_t seq = 0;
+    uint32_t ack = 0;
+    uint8_t flags = 0;
+    uint16_t window = 65535;
+    uint16_t urgent = 0;
+    // Padded with zeros (end of options) to a multiple of 4 bytes. At most 40 bytes
+    std::span<const uint8_t> options = {};
+};
+
+class PacketBuilder
+{
+public:
+    // Build into packet, replacing whatever was in it
+    explicit PacketBuilder(std::vector<uint8_t> &packet_) :packet(packet_)
+    {
+        packet.clear();
+    }
+
+    PacketBuilder &ethernet(const EthernetHeader &header)
+    {
+        uint8_t *p = grow(14);
+        memcpy(p, header.dst.bytes.data(), 6);
+        memcpy(p + 6, header.src.bytes.data(), 6);
+        put16(p + 12, header.ethertype.value_or(0));
+        if(!header.ethertype)
+        {
+            ethertype_offset = p + 12 - packet.data();
+        }
+        return *this;
+    }
+
+    PacketBuilder &arp(const ArpHeader &header)
+    {
+        setEthertype(EtherType::ARP);
+        uint8_t *p = grow(28);
+        // Ethernet and IPv4, with their address lengths
+        put16(p, 1);
+        put16(p + 2, EtherType::IPV4);
+        p[4] = 6;
+        p[5] = 4;
+        put16(p + 6, header.operation);
+        memcpy(p + 8, header.sender_mac.bytes.data(), 6);
+        put32(p + 14, header.sender_ip);
+        memcpy(p + 18, header.target_mac.bytes.data(), 6);
+        put32(p + 24, header.target_ip);
+        return *this;
+    }
+
+    PacketBuilder &ipv4(const Ipv4Header &header)
+    {
+        if(ip_offset)
+        {
+            throw PacketBuilderException("Packet already has an IPv4 header");
+        }
+        setEthertype(EtherType::IPV4);
+
+        size_t options_length = paddedLength(header.options, "IPv4");
+        ip_offset = packet.size();
+        ip_header_length = 20 + options_length;
+        uint8_t *p = grow(ip_header_length);
+        p[0] = 0x40 | (ip_header_length / 4);
+        p[1] = header.tos;
+        // Total length and checksum are filled in by finish
+        put16(p + 4, header.identification);
+        put16(p + 6, header.dont_fragment ? 0x4000 : 0);
+        p[8] = header.ttl;
+        p[9] = header.protocol.value_or(0);
+        put32(p + 12, header.src);
+        put32(p + 16, header.dst);
+        std::copy(header.options.begin(), header.options.end(), p + 20);
+        ip_protocol_set = header.protocol.has_value();
+        return *this;
+    }
+
+    PacketBuilder &udp(const UdpHeader &header)
+    {
+        startL4(L4::UDP, IpProtocol::UDP);
+        udp_checksum = header.checksum;
+        uint8_t *p = grow(8);
+        put16(p, header.src_port);
+        put16(p + 2, header.dst_port);
+        return *this;
+    }
+
+    PacketBuilder &tcp(const TcpHeader &header)
+    {
+        startL4(L4::TCP, IpProtocol::TCP);
+        size_t options_length = paddedLength(header.options, "TCP");
+        uint8_t *p = grow(20 + options_length);
+        put16(p, header.src_port);
+        put16(p + 2, header.dst_port);
+        put32(p + 4, header.seq);
+        put32(p + 8, header.ack);
+        p[12] = ((20 + options_length) / 4) << 4;
+        p[13] = header.flags;
+        put16(p + 14, header.window);
+        put16(p + 18, header.urgent);
+        std::copy(header.options.begin(), header.options.end(), p + 20);
+        return *this;
+    }
+
+    PacketBuilder &payload(std::span<const uint8_t> data)
+    {
+        uint8_t *p = grow(data.size());
+        std::copy(data.begin(), data.end(), p);
+        return *this;
+    }
+
+    // Random bytes
+    PacketBuilder &payload(size_t length, SimRandom &random)
+    {
+        uint8_t *p = grow(length);
+        for(size_t i=0; i < length; i += sizeof(uint64_t))
+        {
+            uint64_t bits = random();
+            memcpy(p + i, &bits, std::min(sizeof(bits), length - i));
+        }
+        return *this;
+    }
+
+    // Fill in the lengths and checksums. The packet can still be added to afterwards, as long as finish is called again
+    std::span<uint8_t> finish(void)
+    {
+        if(ethertype_offset && !ethertype_set)
+        {
+            throw PacketBuilderException("Ethertype wasn't given, and there is no layer after ethernet to work it out from");
+        }
+
+        uint64_t pseudo_header_sum = 0;
+        if(ip_offset)
+        {
+            uint8_t *ip = packet.data() + *ip_offset;
+            size_t total_length = packet.size() - *ip_offset;
+            if(total_length > 0xFFFF)
+            {
+                throw PacketBuilderException("IPv4 packet is too long, at " + std::to_string(total_length) + " bytes");
+            }
+            if(!ip_protocol_set)
+            {
+                throw PacketBuilderException("IP protocol wasn't given, and there is no UDP or TCP header to work it out from");
+            }
+            put16(ip + 2, total_length);
+            put16(ip + 10, 0);
+            put16(ip + 10, InternetChecksum::compute(std::span<const uint8_t>(ip, ip_header_length)));
+
+            // Source and destination addresses, protocol and L4 length
+            pseudo_header_sum = InternetChecksum::add(0, std::span<const uint8_t>(ip + 12, 8));
+            pseudo_header_sum += ip[9];
+            pseudo_header_sum += packet.size() - l4_offset;
+        }
+
+        uint8_t *l4 = packet.data() + l4_offset;
+        std::span<const uint8_t> segment(l4, packet.size() - l4_offset);
+        if(l4_type == L4::UDP)
+        {
+            if(segment.size() > 0xFFFF)
+            {
+                throw PacketBuilderException("UDP datagram is too long, at " + std::to_string(segment.size()) + " bytes");
+            }
+            put16(l4 + 4, segment.size());
+            put16(l4 + 6, 0);
+            if(ip_offset && udp_checksum)
+            {
+                // Zero means no checksum, so a checksum of zero is sent as all ones
+                uint16_t checksum = InternetChecksum::finish(InternetChecksum::add(pseudo_header_sum, segment));
+                put16(l4 + 6, checksum ? checksum : 0xFFFF);
+            }
+        } else if(l4_type == L4::TCP) {
+            put16(l4 + 16, 0);
+            if(ip_offset)
+            {
+                put16(l4 + 16, InternetChecksum::finish(InternetChecksum::add(pseudo_header_sum, segment)));
+            }
+        }
+
+        return packet;
+    }
+
+private:
+    enum class L4 {NONE, UDP, TCP};
+
+    std::vector<uint8_t> &packet;
+    std::optional<size_t> ethertype_offset;
+    bool ethertype_set = false;
+    std::optional<size_t> ip_offset;
+    size_t ip_header_length = 0;
+    bool ip_protocol_set = false;
+    L4 l4_type = L4::NONE;
+    size_t l4_offset = 0;
+    bool udp_checksum = true;
+
+    uint8_t *grow(size_t n)
+    {
+        size_t old_size = packet.size();
+        packet.resize(old_size + n);
+        return packet.data() + old_size;
+    }
+
+    static void put16(uint8_t *p, uint16_t value)
+    {
+        p[0] = value >> 8;
+        p[1] = value;
+    }
+
+    static void put32(uint8_t *p, uint32_t value)
+    {
+        put16(p, value >> 16);
+        put16(p + 2, value);
+    }
+
+    static size_t paddedLength(std::span<const uint8_t> options, const char *layer)
+    {
+        if(options.size() > 40)
+        {
+            throw PacketBuilderException(std::string(layer) + " options can be at most 40 bytes, not " + std::to_string(options.size()));
+        }
+        return (options.size() + 3) & ~size_t(3);
+    }
+
+    // Fill in the ethertype, if the ethernet header left it to us
+    void setEthertype(uint16_t ethertype)
+    {
+        if(ethertype_offset && !ethertype_set)
+        {
+            put16(packet.data() + *ethertype_offset, ethertype);
+        }
+        ethertype_set = true;
+    }
+
+    void startL4(L4 type, uint8_t protocol)
+    {
+        if(l4_type != L4::NONE)
+        {
+            throw PacketBuilderException("Packet already has a UDP or TCP header");
+        }
+        if(ip_offset && !ip_protocol_set)
+        {
+            packet[*ip_offset + 9] = protocol;
+            ip_protocol_set = true;
+        }
+        l4_type = type;
+        l4_offset = packet.size();
+    }
+};
+
+struct RandomTrafficConfig
+{
+    // Otherwise packets start at the IP header
+    bool ethernet = true;
+    MacAddress dst_mac = MacAddress::fromUint64(0x020000000002);
+    MacAddress src_mac = MacAddress::fromUint64(0x020000000001);
+    // Addresses are picked from count addresses starting at these
+    uint32_t src_ip = ipv4Address(10, 0, 0, 1);
+    uint32_t src_ip_count = 1;
+    uint32_t dst_ip = ipv4Address(10, 0, 0, 2);
+    uint32_t dst_ip_count = 1;
+    uint16_t min_port = 1;
+    uint16_t max_port = 65535;
+    // The rest are UDP
+    double tcp_fraction = 0.5;
+    // Inclusive. The default fits in a standard MTU with the biggest headers
+    size_t min_payload = 0;
+    size_t max_payload = 1420;
+    // How often to add IP or TCP options
+    double ip_options_fraction = 0;
+    double tcp_options_fraction = 0;
+};
+
+namespace PacketGenerators
+{
+    // Varied UDP and TCP over IPv4, for use with GeneratorPacketSource
+    // Every packet has correct lengths and checksums, with random addresses, ports, sequence numbers, options and payloads
+    inline auto randomTraffic(RandomTrafficConfig config=RandomTrafficConfig{}, uint64_t seed=0)
+    {
+        if(config.min_port > config.max_port || config.min_payload > config.max_payload || !config.src_ip_count || !config.dst_ip_count)
+        {
+            throw std::invalid_argument("Random traffic ranges are empty");
+        }
+
+        return [=](uint64_t index, std::vector<uint8_t> &out)
+        {
+            auto random = packetRandom(seed, index);
+            auto port = [&]() {return static_cast<uint16_t>(config.min_port + random.nextBelow(config.max_port - config.min_port + 1));};
+
+            PacketBuilder builder(out);
+            if(config.ethernet)
+            {
+                builder.ethernet({.dst = config.dst_mac, .src = config.src_mac});
+            }
+
+            // Router alert, padded out with a random number of no-ops
+            std::array<uint8_t, 40> ip_options{};
+            size_t ip_options_length = 0;
+            if(random.nextDouble() < config.ip_options_fraction)
+            {
+                ip_options_length = 4 * (1 + random.nextBelow(10));
+                std::fill(ip_options.begin(), ip_options.begin() + ip_options_length, 0x01);
+                const uint8_t router_alert[] = {0x94, 0x04, 0x00, 0x00};
+                std::copy(std::begin(router_alert), std::end(router_alert), ip_options.begin() + ip_options_length - 4);
+            }
+
+            builder.ipv4({.src = config.src_ip + static_cast<uint32_t>(random.nextBelow(config.src_ip_count)),
+                          .dst = config.dst_ip + static_cast<uint32_t>(random.nextBelow(config.dst_ip_count)),
+                          .identification = static_cast<uint16_t>(index),
+                          .options = std::span<const uint8_t>(ip_options.data(), ip_options_length)});
+
+            if(random.nextDouble() < config.tcp_fraction)
+            {
+                // Some of MSS, window scale, SACK permitted and timestamps, as a SYN would have
+                std::array<uint8_t, 40> tcp_options{};
+                size_t tcp_options_length = 0;
+                if(random.nextDouble() < config.tcp_options_fraction)
+                {
+                    auto add = [&](std::initializer_list<uint8_t> option)
+                    {
+                        std::copy(option.begin(), option.end(), tcp_options.begin() + tcp_options_length);
+                        tcp_options_length += option.size();
+                    };
+                    uint64_t which = random();
+                    if(which & 1) add({0x02, 0x04, 0x05, 0xB4});
+                    if(which & 2) add({0x01, 0x03, 0x03, static_cast<uint8_t>(which >> 8 & 0xF)});
+                    if(which & 4) add({0x01, 0x01, 0x04, 0x02});
+                    if(which & 8)
+                    {
+                        uint32_t ts = static_cast<uint32_t>(which >> 32);
+                        add({0x01, 0x01, 0x08, 0x0A, static_cast<uint8_t>(ts >> 24), static_cast<uint8_t>(ts >> 16), static_cast<uint8_t>(ts >> 8), static_cast<uint8_t>(ts), 0, 0, 0, 0});
+                    }
+                }
+
+                uint64_t numbers = random();
+                builder.tcp({.src_port = port(), .dst_port = port(),
+                             .seq = static_cast<uint32_t>(numbers), .ack = static_cast<uint32_t>(numbers >> 32),
+                             .flags = static_cast<uint8_t>(TcpFlags::ACK | (random() & (TcpFlags::PSH | TcpFlags::FIN))),
+                             .window = static_cast<uint16_t>(random()),
+                             .options = std::span<const uint8_t>(tcp_options.data(), tcp_options_length)});
+            } else {
+                builder.udp({.src_port = port(), .dst_port = port()});
+            }
+
+            builder.payload(config.min_payload + random.nextBelow(config.max_payload - config.min_payload + 1), random);
+            builder.finish();
+        };
+    }
+}
+
+#endif
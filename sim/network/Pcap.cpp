@@ -0,0 +1,444 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#include "Pcap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// File formats are described at https://www.tcpdump.org/manpages/pcap-savefile.5.html and https://pcapng.com
+namespace
+{
+    constexpr uint32_t pcap_magic_us = 0xA1B2C3D4;
+    constexpr uint32_t pcap_magic_ns = 0xA1B23C4D;
+
+    constexpr uint32_t pcapng_section_header = 0x0A0D0D0A;
+    constexpr uint32_t pcapng_interface_description = 1;
+    constexpr uint32_t pcapng_simple_packet = 3;
+    constexpr uint32_t pcapng_enhanced_packet = 6;
+    constexpr uint32_t pcapng_byte_order_magic = 0x1A2B3C4D;
+
+    constexpr uint16_t pcapng_opt_endofopt = 0;
+    constexpr uint16_t pcapng_opt_if_tsresol = 9;
+    constexpr uint16_t pcapng_opt_if_fcslen = 13;
+
+    // Anything bigger than this is assumed to be a corrupt length, rather than a real packet
+    constexpr uint32_t max_block_bytes = 1 << 24;
+}
+
+PcapPacketSource::PcapPacketSource(const std::string &filename_, PcapReaderConfig config_)
+    :filename(filename_), is(filename_, std::ios::binary), config(config_)
+{
+    if(!is)
+    {
+        throw PcapException("Couldn't open packet capture " + filename);
+    }
+
+    uint32_t magic;
+    if(!tryRead(&magic, sizeof(magic)))
+    {
+        throw PcapException(filename + " is empty");
+    }
+
+    if(magic == pcapng_section_header)
+    {
+        format = Format::PCAPNG;
+        readSectionHeader();
+        return;
+    }
+
+    format = Format::PCAP;
+    swapped = (magic == __builtin_bswap32(pcap_magic_us)) || (magic == __builtin_bswap32(pcap_magic_ns));
+    if(swapped)
+    {
+        magic = __builtin_bswap32(magic);
+    }
+    if(magic != pcap_magic_us && magic != pcap_magic_ns)
+    {
+        throw PcapException(filename + " is not a pcap or pcapng file");
+    }
+
+    // Version, time zone, sigfigs, snaplen, link type
+    uint8_t header[20];
+    read(header, sizeof(header));
+    uint32_t network = get32(header + 16);
+
+    Interface interface;
+    interface.link_type = network & 0xFFFF;
+    // If the F bit is set, the top bits say how many 16 bit words of FCS each packet has
+    if(network & 0x04000000)
+    {
+        interface.fcs_bytes = ((network >> 28) & 0xF) * 2;
+    }
+    interface.exponent = (magic == pcap_magic_ns) ? 9 : 6;
+    interfaces.push_back(interface);
+}
+
+std::optional<std::vector<uint8_t>> PcapPacketSource::receive()
+{
+    std::vector<uint8_t> packet;
+    if(!readPacket(packet))
+    {
+        return std::nullopt;
+    }
+    return packet;
+}
+
+std::optional<PacketHandle<uint8_t>> PcapPacketSource::receivePooled(PacketPool<uint8_t> &pool)
+{
+    auto handle = pool.acquire();
+    if(!readPacket(*handle))
+    {
+        return std::nullopt;
+    }
+    return handle;
+}
+
+bool PcapPacketSource::readPacket(std::vector<uint8_t> &packet)
+{
+    return (format == Format::PCAP) ? readPcapPacket(packet) : readPcapngPacket(packet);
+}
+
+bool PcapPacketSource::readPcapPacket(std::vector<uint8_t> &packet)
+{
+    // Seconds, fraction of a second, captured length, original length
+    uint8_t header[16];
+    if(!tryRead(header, sizeof(header)))
+    {
+        return false;
+    }
+
+    uint32_t captured_length = get32(header + 8);
+    if(captured_length > max_block_bytes)
+    {
+        throw PcapException(filename + " has a packet of " + std::to_string(captured_length) + " bytes, it is probably corrupt");
+    }
+    packet.resize(captured_length);
+    read(packet.data(), captured_length);
+
+    const Interface &interface = interfaces.front();
+    uint64_t fraction_ns = get32(header + 4) * ((interface.exponent == 6) ? 1000ull : 1ull);
+    finishPacket(packet, interface, get32(header) * 1000000000ull + fraction_ns, get32(header + 12));
+    return true;
+}
+
+bool PcapPacketSource::readPcapngPacket(std::vector<uint8_t> &packet)
+{
+    // Skip over anything that isn't a packet
+    while(true)
+    {
+        uint32_t type;
+        if(!tryRead(&type, sizeof(type)))
+        {
+            return false;
+        }
+
+        if(type == pcapng_section_header)
+        {
+            readSectionHeader();
+            continue;
+        }
+        type = get32(reinterpret_cast<const uint8_t *>(&type));
+
+        // The block length is at both ends, read everything after the first one
+        uint8_t length_bytes[4];
+        read(length_bytes, sizeof(length_bytes));
+        uint32_t length = get32(length_bytes);
+        if(length < 12 || length % 4 != 0 || length > max_block_bytes)
+        {
+            throw PcapException(filename + " has a block with an invalid length of " + std::to_string(length));
+        }
+        block.resize(length - 8);
+        read(block.data(), block.size());
+        if(get32(block.data() + block.size() - 4) != length)
+        {
+            throw PcapException(filename + " has a block with mismatched lengths, it is probably corrupt");
+        }
+
+        const uint8_t *body = block.data();
+        size_t body_length = length - 12;
+
+        if(type == pcapng_interface_description)
+        {
+            addInterface();
+        } else if(type == pcapng_enhanced_packet) {
+            if(body_length < 20)
+            {
+                throw PcapException(filename + " has a truncated enhanced packet block");
+            }
+            uint32_t interface_id = get32(body);
+            uint64_t ts = (static_cast<uint64_t>(get32(body + 4)) << 32) | get32(body + 8);
+            uint32_t captured_length = get32(body + 12);
+            if(interface_id >= interfaces.size() || captured_length > body_length - 20)
+            {
+                throw PcapException(filename + " has an enhanced packet block with an unknown interface, or that overruns the block");
+            }
+            packet.assign(body + 20, body + 20 + captured_length);
+            finishPacket(packet, interfaces[interface_id], toNanoseconds(ts, interfaces[interface_id]), get32(body + 16));
+            return true;
+        } else if(type == pcapng_simple_packet) {
+            if(body_length < 4 || interfaces.empty())
+            {
+                throw PcapException(filename + " has a simple packet block that is truncated, or comes before any interface");
+            }
+            // The block is padded, so use the original length unless the block is shorter (i.e. the packet was truncated)
+            uint32_t original_length = get32(body);
+            size_t captured_length = std::min<size_t>(original_length, body_length - 4);
+            packet.assign(body + 4, body + 4 + captured_length);
+            finishPacket(packet, interfaces.front(), std::nullopt, original_length);
+            return true;
+        }
+    }
+}
+
+void PcapPacketSource::readSectionHeader(void)
+{
+    // The block type has already been read. The byte order magic comes after the length, so read them both before using either
+    uint8_t header[8];
+    read(header, sizeof(header));
+    uint32_t byte_order;
+    memcpy(&byte_order, header + 4, sizeof(byte_order));
+    if(byte_order == pcapng_byte_order_magic)
+    {
+        swapped = false;
+    } else if(byte_order == __builtin_bswap32(pcapng_byte_order_magic)) {
+        swapped = true;
+    } else {
+        throw PcapException(filename + " has a pcapng section header with an invalid byte order magic");
+    }
+
+    uint32_t length = get32(header);
+    if(length < 28 || length % 4 != 0 || length > max_block_bytes)
+    {
+        throw PcapException(filename + " has a pcapng section header with an invalid length of " + std::to_string(length));
+    }
+
+    // Nothing else in it is needed
+    block.resize(length - 12);
+    read(block.data(), block.size());
+
+    // Interface IDs are per section
+    interfaces.clear();
+}
+
+void PcapPacketSource::addInterface(void)
+{
+    const uint8_t *body = block.data();
+    size_t body_length = block.size() - 4;
+    if(body_length < 8)
+    {
+        throw PcapException(filename + " has a truncated interface description block");
+    }
+
+    Interface interface;
+    interface.link_type = get16(body);
+
+    size_t pos = 8;
+    while(pos + 4 <= body_length)
+    {
+        uint16_t code = get16(body + pos);
+        uint16_t length = get16(body + pos + 2);
+        if(code == pcapng_opt_endofopt)
+        {
+            break;
+        }
+        if(pos + 4 + length > body_length)
+        {
+            throw PcapException(filename + " has an interface option that overruns its block");
+        }
+
+        const uint8_t *value = body + pos + 4;
+        if(code == pcapng_opt_if_tsresol && length >= 1)
+        {
+            interface.binary = value[0] & 0x80;
+            interface.exponent = value[0] & 0x7F;
+            if(interface.exponent > (interface.binary ? 63u : 19u))
+            {
+                throw PcapException(filename + " has an unsupported timestamp resolution");
+            }
+        } else if(code == pcapng_opt_if_fcslen && length >= 1) {
+            interface.fcs_bytes = value[0];
+        }
+
+        // Options are padded to 32 bits
+        pos += 4 + ((length + 3) & ~3u);
+    }
+
+    interfaces.push_back(interface);
+}
+
+void PcapPacketSource::finishPacket(std::vector<uint8_t> &packet, const Interface &interface, std::optional<uint64_t> ts, uint32_t original_length)
+{
+    if(config.link_type && interface.link_type != *config.link_type)
+    {
+        throw PcapException(filename + " has a packet of link type " + std::to_string(interface.link_type) + ", expected " + std::to_string(*config.link_type));
+    }
+
+    if(packet.size() < original_length)
+    {
+        if(!config.allow_truncated)
+        {
+            throw PcapException(filename + " packet " + std::to_string(num_packets) + " was truncated from " + std::to_string(original_length) +
+                                " to " + std::to_string(packet.size()) + " bytes when it was captured");
+        }
+    } else {
+        // If the packet was truncated, the FCS will already have gone
+        size_t fcs_bytes = interface.fcs_bytes ? interface.fcs_bytes : (config.strip_fcs ? 4 : 0);
+        packet.resize(packet.size() - std::min(fcs_bytes, packet.size()));
+    }
+
+    if(ts)
+    {
+        timestamp = *ts;
+    }
+    link_type = interface.link_type;
+    num_packets++;
+}
+
+uint64_t PcapPacketSource::toNanoseconds(uint64_t ts, const Interface &interface)
+{
+    if(interface.binary)
+    {
+        return static_cast<uint64_t>(std::ldexp(static_cast<long double>(ts) * 1e9L, -static_cast<int>(interface.exponent)));
+    }
+
+    uint64_t scale = 1;
+    for(unsigned int i=std::min(interface.exponent, 9u); i < std::max(interface.exponent, 9u); i++)
+    {
+        scale *= 10;
+    }
+    return (interface.exponent <= 9) ? ts * scale : ts / scale;
+}
+
+bool PcapPacketSource::tryRead(void *data, size_t bytes)
+{
+    is.read(static_cast<char *>(data), bytes);
+    if(is.gcount() == 0 && bytes != 0)
+    {
+        return false;
+    }
+    if(static_cast<size_t>(is.gcount()) != bytes)
+    {
+        throw PcapException(filename + " ends part way through a packet");
+    }
+    return true;
+}
+
+void PcapPacketSource::read(void *data, size_t bytes)
+{
+    if(!tryRead(data, bytes))
+    {
+        throw PcapException(filename + " ends part way through a packet");
+    }
+}
+
+uint16_t PcapPacketSource::get16(const uint8_t *p) const
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped ? __builtin_bswap16(value) : value;
+}
+
+uint32_t PcapPacketSource::get32(const uint8_t *p) const
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped ? __builtin_bswap32(value) : value;
+}
+
+
+PcapPacketSink::PcapPacketSink(const std::string &filename_, const vluint64_t &time_, double resolution, PcapWriterConfig config_)
+    :filename(filename_), os(filename_, std::ios::binary | std::ios::trunc), time(time_), ns_per_tick(resolution * 1e9), config(config_)
+{
+    if(!os)
+    {
+        throw PcapException("Couldn't open packet capture " + filename + " for writing");
+    }
+
+    if(config.format == PcapFormat::PCAP)
+    {
+        // Nanosecond timestamps, version 2.4, UTC, no sigfigs
+        const uint32_t magic = pcap_magic_ns;
+        const uint16_t version[2] = {2, 4};
+        const uint32_t rest[4] = {0, 0, config.snaplen, config.link_type};
+        write(&magic, sizeof(magic));
+        write(version, sizeof(version));
+        write(rest, sizeof(rest));
+        return;
+    }
+
+    // Section header, with the version and an unknown section length
+    const uint32_t section_header[7] = {pcapng_section_header, 28, pcapng_byte_order_magic, 1, 0xFFFFFFFF, 0xFFFFFFFF, 28};
+    write(section_header, sizeof(section_header));
+
+    // Interface description, with nanosecond timestamps, and the FCS length if there is one
+    const uint32_t interface_length = 20 + 8 + (config.has_fcs ? 8 : 0) + 4;
+    const uint32_t interface_header[2] = {pcapng_interface_description, interface_length};
+    const uint16_t link_type[2] = {static_cast<uint16_t>(config.link_type), 0};
+    write(interface_header, sizeof(interface_header));
+    write(link_type, sizeof(link_type));
+    write(&config.snaplen, sizeof(config.snaplen));
+    const uint8_t ts_resolution = 9;
+    writeOption(pcapng_opt_if_tsresol, &ts_resolution, sizeof(ts_resolution));
+    if(config.has_fcs)
+    {
+        const uint8_t fcs_length = 4;
+        writeOption(pcapng_opt_if_fcslen, &fcs_length, sizeof(fcs_length));
+    }
+    writeOption(pcapng_opt_endofopt, nullptr, 0);
+    write(&interface_length, sizeof(interface_length));
+}
+
+void PcapPacketSink::send(std::span<uint8_t> data)
+{
+    uint64_t ts = std::llround(time * ns_per_tick);
+    uint32_t original_length = data.size();
+    uint32_t captured_length = std::min<uint32_t>(original_length, config.snaplen);
+
+    if(config.format == PcapFormat::PCAP)
+    {
+        const uint32_t header[4] = {static_cast<uint32_t>(ts / 1000000000), static_cast<uint32_t>(ts % 1000000000), captured_length, original_length};
+        write(header, sizeof(header));
+        write(data.data(), captured_length);
+    } else {
+        const uint32_t padding = (4 - captured_length % 4) % 4;
+        const uint32_t length = 32 + captured_length + padding;
+        const uint32_t header[7] = {pcapng_enhanced_packet, length, 0, static_cast<uint32_t>(ts >> 32), static_cast<uint32_t>(ts), captured_length, original_length};
+        static constexpr uint8_t zeros[4] = {};
+        write(header, sizeof(header));
+        write(data.data(), captured_length);
+        write(zeros, padding);
+        write(&length, sizeof(length));
+    }
+    num_packets++;
+}
+
+void PcapPacketSink::flush(void)
+{
+    os.flush();
+}
+
+void PcapPacketSink::write(const void *data, size_t bytes)
+{
+    os.write(static_cast<const char *>(data), bytes);
+    if(!os)
+    {
+        throw PcapException("Couldn't write packet capture " + filename);
+    }
+}
+
+void PcapPacketSink::writeOption(uint16_t code, const void *data, uint16_t bytes)
+{
+    static constexpr uint8_t zeros[4] = {};
+    const uint16_t header[2] = {code, bytes};
+    write(header, sizeof(header));
+    write(data, bytes);
+    write(zeros, (4 - bytes % 4) % 4);
+}
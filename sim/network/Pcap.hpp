@@ -0,0 +1,149 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef PCAP_HPP
+#define PCAP_HPP
+
+// Read and write packet captures, so real traffic can be replayed through a simulation and the results opened in wireshark
+// The reader takes both pcap and pcapng files (in either byte order), streaming them rather than loading them all up front
+// The writer stamps each packet with the simulation time
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "verilated.h"
+
+#include "../other/PacketSourceSink.hpp"
+
+class PcapException : public std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// The link types that matter here. See https://www.tcpdump.org/linktypes.html for the rest
+namespace PcapLinkType
+{
+    constexpr uint32_t ETHERNET = 1;
+    // Packets start at the IP header, e.g. for a Tun interface
+    constexpr uint32_t RAW_IP = 101;
+}
+
+struct PcapReaderConfig
+{
+    // If set, throw if the capture contains packets of any other link type
+    std::optional<uint32_t> link_type = PcapLinkType::ETHERNET;
+    // Remove the ethernet FCS from the end of each packet, e.g. before replaying it through GMIISource, which adds its own
+    // pcapng files that say their packets have an FCS (if_fcslen) always have it removed
+    bool strip_fcs = false;
+    // Packets that weren't captured in full (because of the snaplen) are an error, unless this is set
+    bool allow_truncated = false;
+};
+
+class PcapPacketSource : public PacketSource<uint8_t>
+{
+public:
+    explicit PcapPacketSource(const std::string &filename, PcapReaderConfig config_=PcapReaderConfig{});
+
+    std::optional<std::vector<uint8_t>> receive() override;
+    std::optional<PacketHandle<uint8_t>> receivePooled(PacketPool<uint8_t> &pool) override;
+
+    // When the packet last returned was captured, in ns since the epoch
+    uint64_t getTimestamp(void) const {return timestamp;};
+    // Link type of the packet last returned
+    uint32_t getLinkType(void) const {return link_type;};
+    uint64_t getNumPackets(void) const {return num_packets;};
+
+private:
+    struct Interface
+    {
+        uint32_t link_type;
+        uint32_t fcs_bytes = 0;
+        // Timestamps are in units of 10^-exponent seconds, or 2^-exponent if binary is set
+        bool binary = false;
+        unsigned int exponent = 6;
+    };
+
+    enum class Format {PCAP, PCAPNG};
+
+    std::string filename;
+    std::ifstream is;
+    PcapReaderConfig config;
+    Format format;
+    // Whether the file (or for pcapng, the current section) is in the other byte order
+    bool swapped = false;
+
+    // For pcap the one interface is made up from the file header
+    std::vector<Interface> interfaces;
+    // pcapng blocks are read into here, then the packet copied out
+    std::vector<uint8_t> block;
+
+    uint64_t timestamp = 0;
+    uint32_t link_type = 0;
+    uint64_t num_packets = 0;
+
+    // Read the next packet into packet, returning false at the end of the file
+    bool readPacket(std::vector<uint8_t> &packet);
+    bool readPcapPacket(std::vector<uint8_t> &packet);
+    bool readPcapngPacket(std::vector<uint8_t> &packet);
+    void readSectionHeader(void);
+    void addInterface(void);
+    // Timestamp is in ns, and missing for pcapng simple packet blocks (which keep the last packet's)
+    void finishPacket(std::vector<uint8_t> &packet, const Interface &interface, std::optional<uint64_t> ts, uint32_t original_length);
+    static uint64_t toNanoseconds(uint64_t ts, const Interface &interface);
+
+    // Returns false if the file ended before anything was read, throws if it ended part way through
+    bool tryRead(void *data, size_t bytes);
+    // Throws if the file ended
+    void read(void *data, size_t bytes);
+    uint16_t get16(const uint8_t *p) const;
+    uint32_t get32(const uint8_t *p) const;
+};
+
+enum class PcapFormat {PCAP, PCAPNG};
+
+struct PcapWriterConfig
+{
+    PcapFormat format = PcapFormat::PCAPNG;
+    uint32_t link_type = PcapLinkType::ETHERNET;
+    // Packets longer than this are truncated
+    uint32_t snaplen = 65535;
+    // Whether the packets end with an FCS, as they do from GMIISink. Only recorded in pcapng files, wireshark guesses for pcap
+    bool has_fcs = false;
+};
+
+class PcapPacketSink : public PacketSink<uint8_t>
+{
+public:
+    // Timestamps are taken from time (normally the model's getTime()), which counts in units of resolution seconds, as for ClockGen
+    // So packets appear to have been captured in the first moments of 1970
+    PcapPacketSink(const std::string &filename, const vluint64_t &time_, double resolution, PcapWriterConfig config_=PcapWriterConfig{});
+
+    void send(std::span<uint8_t> data) override;
+
+    // Make everything sent so far visible in the file, e.g. to look at it whilst the simulation is running
+    void flush(void);
+
+    uint64_t getNumPackets(void) const {return num_packets;};
+
+private:
+    std::string filename;
+    std::ofstream os;
+    const vluint64_t &time;
+    const double ns_per_tick;
+    PcapWriterConfig config;
+    uint64_t num_packets = 0;
+
+    void write(const void *data, size_t bytes);
+    void writeOption(uint16_t code, const void *data, uint16_t bytes);
+};
+
+#endif
@@ -39,6 +39,7 @@ TunTapInterface::TunTapInterface(Type t, const char *dev_name)
 
     mtu = ifr.ifr_mtu;
     name = std::string(ifr.ifr_name);
+    rx_buffer.resize(mtu);
 }
 
 void TunTapInterface::send(std::span<uint8_t> data)
@@ -46,10 +47,9 @@ void TunTapInterface::send(std::span<uint8_t> data)
     write(fd, data.data(), data.size());
 }
 
-std::optional<std::vector<uint8_t>> TunTapInterface::receive()
+size_t TunTapInterface::readPacket(uint8_t *buf, size_t len)
 {
-    std::vector<uint8_t> ret(mtu);
-    ssize_t n_read = read(fd, ret.data(), ret.size());
+    ssize_t n_read = read(fd, buf, len);
     if(n_read < 0)
     {
         if(!((errno == EAGAIN) || (errno == EWOULDBLOCK)))
@@ -58,7 +58,29 @@ std::optional<std::vector<uint8_t>> TunTapInterface::receive()
         }
         n_read = 0;
     }
-    ret.resize(n_read);
+    return n_read;
+}
 
-    return ret.size()? std::optional<std::vector<uint8_t>>(ret) : std::nullopt;
+std::optional<std::vector<uint8_t>> TunTapInterface::receive()
+{
+    size_t n_read = readPacket(rx_buffer.data(), rx_buffer.size());
+    if(!n_read)
+    {
+        return std::nullopt;
+    }
+    return std::vector<uint8_t>(rx_buffer.begin(), rx_buffer.begin() + n_read);
+}
+
+std::optional<PacketHandle<uint8_t>> TunTapInterface::receivePooled(PacketPool<uint8_t> &pool)
+{
+    // Read straight into the pooled buffer. If there is nothing to read it goes straight back to the pool
+    auto packet = pool.acquire();
+    packet->resize(mtu);
+    size_t n_read = readPacket(packet->data(), packet->size());
+    if(!n_read)
+    {
+        return std::nullopt;
+    }
+    packet->resize(n_read);
+    return packet;
 }
\ No newline at end of file
@@ -36,11 +36,18 @@ protected:
 
     void send(std::span<uint8_t> data) override;
     std::optional<std::vector<uint8_t>> receive() override;
+    std::optional<PacketHandle<uint8_t>> receivePooled(PacketPool<uint8_t> &pool) override;
 
 private:
     int fd;
     int mtu;
     std::string name;
+
+    // Most polls find nothing, so read into this rather than allocating each time
+    std::vector<uint8_t> rx_buffer;
+
+    // Read a packet into buf, returning the number of bytes read (0 if there was nothing to read)
+    size_t readPacket(uint8_t *buf, size_t len);
 };
 
 // IP level interface
@@ -20,10 +20,14 @@ class ClockGen
 {
 public:
 	enum class Event {NONE, RISING, FALLING};
-	ClockGen(const vluint64_t &count_in, double resolution, double freq)
-		:count(count_in), ticksPerClock(round((1.0/freq)*(1.0/resolution))) {};
+	ClockGen(const vluint64_t &count_in, double resolution_, double freq)
+		:count(count_in), ticksPerClock(round((1.0/freq)*(1.0/resolution_))), resolution(resolution_) {};
 	bool getVal(void) {updateTime(); return val;};
 	Event getEvent(void) {updateTime(); return event;}
+	vluint64_t getTime(void) const {return count;}
+	unsigned int getTicksPerClock(void) const {return ticksPerClock;}
+	// Length of a tick in seconds
+	double getResolution(void) const {return resolution;}
 	std::string eventToStr(Event e) const
 	{
 		switch(e)
@@ -44,6 +48,7 @@ private:
 	bool val;
 	Event event;
 	const unsigned int ticksPerClock;
+	const double resolution;
 
  	void updateTime(void)
 	{
@@ -0,0 +1,176 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef GENERATOR_PACKET_SOURCE_HPP
+#define GENERATOR_PACKET_SOURCE_HPP
+
+// Packet source that makes each packet when it is asked for, so long stimulus doesn't need to be held in memory
+// Packets are a function of their index (and a seed), so the same packets can be generated again to check the output against
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "PacketSourceSink.hpp"
+#include "SimRandom.hpp"
+
+template <class T> class GeneratorPacketSource : public PacketSource<T>
+{
+public:
+    // Fill in packet number index. The packet is passed in empty, but may have capacity left over from an earlier packet
+    using Generator = std::function<void(uint64_t index, std::vector<T> &packet)>;
+
+    GeneratorPacketSource(Generator generator_, uint64_t num_packets_=std::numeric_limits<uint64_t>::max())
+        :generator(std::move(generator_)), num_packets(num_packets_)
+    {
+    }
+
+    std::optional<std::vector<T>> receive() override
+    {
+        if(next == num_packets)
+        {
+            return std::nullopt;
+        }
+        std::vector<T> packet;
+        generator(next++, packet);
+        return packet;
+    }
+
+    // Generate straight into the pooled buffer, so steady state generation doesn't allocate
+    std::optional<PacketHandle<T>> receivePooled(PacketPool<T> &pool) override
+    {
+        if(next == num_packets)
+        {
+            return std::nullopt;
+        }
+        auto handle = pool.acquire();
+        generator(next++, *handle);
+        return handle;
+    }
+
+    uint64_t getNumGenerated(void) const {return next;};
+
+private:
+    Generator generator;
+    uint64_t num_packets;
+    uint64_t next = 0;
+};
+
+// Reusable generators, for use with GeneratorPacketSource
+// The random ones give each packet its own random stream, seeded from the seed and the index,
+// so a packet doesn't depend on which other packets have been generated
+namespace PacketGenerators
+{
+    // Every packet is the same
+    template <class T> auto fixed(std::vector<T> packet)
+    {
+        return [packet = std::move(packet)](uint64_t, std::vector<T> &out) {out.assign(packet.begin(), packet.end());};
+    }
+
+    // Fixed length, counting up from the packet index, so each packet is different
+    template <class T=uint8_t> auto incrementing(size_t length)
+    {
+        return [length](uint64_t index, std::vector<T> &out)
+        {
+            out.resize(length);
+            for(size_t i=0; i < length; i++)
+            {
+                out[i] = static_cast<T>(index + i);
+            }
+        };
+    }
+
+    inline SimRandom packetRandom(uint64_t seed, uint64_t index)
+    {
+        return SimRandom(SimRandom::deriveSeed("PacketGenerators", seed) ^ (index * 0x9e3779b97f4a7c15));
+    }
+
+    // Random length between min_length and max_length (inclusive), counting up from the packet index
+    template <class T=uint8_t> auto randomLength(size_t min_length, size_t max_length, uint64_t seed=0)
+    {
+        return [=](uint64_t index, std::vector<T> &out)
+        {
+            auto random = packetRandom(seed, index);
+            out.resize(min_length + random.nextBelow(max_length - min_length + 1));
+            for(size_t i=0; i < out.size(); i++)
+            {
+                out[i] = static_cast<T>(index + i);
+            }
+        };
+    }
+
+    // Lengths drawn from a mix of (length, weight) pairs, counting up from the packet index
+    template <class T=uint8_t> auto lengthMix(std::vector<std::pair<size_t, unsigned int>> mix, uint64_t seed=0)
+    {
+        unsigned int total_weight = 0;
+        for(const auto &[length, weight] : mix)
+        {
+            total_weight += weight;
+        }
+        if(total_weight == 0)
+        {
+            throw std::invalid_argument("Packet length mix has no weight");
+        }
+
+        return [=](uint64_t index, std::vector<T> &out)
+        {
+            auto random = packetRandom(seed, index);
+            uint64_t pick = random.nextBelow(total_weight);
+            auto iter = mix.begin();
+            while(pick >= iter->second)
+            {
+                pick -= iter->second;
+                iter++;
+            }
+            out.resize(iter->first);
+            for(size_t i=0; i < out.size(); i++)
+            {
+                out[i] = static_cast<T>(index + i);
+            }
+        };
+    }
+
+    // Simple IMIX, 7:4:1 of 64, 594 and 1518 byte ethernet frames
+    // The lengths don't include the FCS, as GMIISource adds that
+    template <class T=uint8_t> auto imix(uint64_t seed=0)
+    {
+        return lengthMix<T>({{60, 7}, {590, 4}, {1514, 1}}, seed);
+    }
+
+    // Random length between min_length and max_length (inclusive), with random contents
+    template <class T=uint8_t> auto randomContent(size_t min_length, size_t max_length, uint64_t seed=0)
+    {
+        return [=](uint64_t index, std::vector<T> &out)
+        {
+            auto random = packetRandom(seed, index);
+            out.resize(min_length + random.nextBelow(max_length - min_length + 1));
+            // Use all of each random number, rather than one per word
+            constexpr size_t per_random = (sizeof(T) < sizeof(uint64_t)) ? sizeof(uint64_t) / sizeof(T) : 1;
+            size_t i = 0;
+            while(i < out.size())
+            {
+                uint64_t bits = random();
+                for(size_t j=0; j < per_random && i < out.size(); j++)
+                {
+                    out[i++] = static_cast<T>(bits);
+                    if constexpr (per_random > 1)
+                    {
+                        bits >>= sizeof(T) * 8;
+                    }
+                }
+            }
+        };
+    }
+}
+
+#endif
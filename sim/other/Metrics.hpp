@@ -0,0 +1,249 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+// Registry of named counters, gauges and histograms gathered during a simulation
+// Every model owns a registry, and peripherals register their metrics with it under a unique instance name
+// The registry owns the storage, so metrics stay valid after the peripheral that created them is destroyed
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <string>
+
+class MetricsCounter
+{
+public:
+    void increment(uint64_t n=1) {value += n;};
+    uint64_t get(void) const {return value;};
+private:
+    uint64_t value = 0;
+};
+
+class MetricsGauge
+{
+public:
+    void set(double v) {value = v;};
+    double get(void) const {return value;};
+private:
+    double value = 0;
+};
+
+// Exact histogram (one bucket per distinct value)
+// Fine for things like FIFO occupancy, where the number of distinct values is small
+class MetricsHistogram
+{
+public:
+    void add(double value, uint64_t n=1)
+    {
+        buckets[value] += n;
+        count += n;
+        sum += value * n;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    void clear(void)
+    {
+        *this = MetricsHistogram{};
+    }
+
+    const std::map<double, uint64_t> &getBuckets(void) const {return buckets;};
+    uint64_t getCount(void) const {return count;};
+    double getSum(void) const {return sum;};
+    double getMean(void) const {return count ? (sum / count) : 0.0;};
+    // Min and max are only meaningful once at least one value has been added
+    double getMin(void) const {return min;};
+    double getMax(void) const {return max;};
+
+    // Smallest value that at least fraction p (0 to 1) of the values are less than or equal to, e.g. 0.5 for the median
+    double getPercentile(double p) const
+    {
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * count)));
+        uint64_t seen = 0;
+        for(const auto &[value, n] : buckets)
+        {
+            seen += n;
+            if(seen >= target)
+            {
+                return value;
+            }
+        }
+        return max;
+    }
+
+private:
+    std::map<double, uint64_t> buckets;
+    uint64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+};
+
+class MetricsScope;
+
+// Gives every model's metrics a unique name, so that runs of the same test can be tracked over time
+// The test harness sets the test case, since trace names are often reused between tests
+struct MetricsContext
+{
+    static inline std::string test_case;
+    // Models named so far in this test case
+    static inline unsigned int num_models = 0;
+
+    static void startTestCase(const std::string &name)
+    {
+        test_case = name;
+        num_models = 0;
+    }
+
+    // e.g. "Test data comes out of FIFO/fifo#0" for the first model in a test case
+    static std::string nextModelName(const std::string &model)
+    {
+        std::string prefix = test_case.empty() ? "" : test_case + "/";
+        return prefix + model + "#" + std::to_string(num_models++);
+    }
+};
+
+class MetricsRegistry
+{
+public:
+    // Metrics are created on first use. References remain valid for the lifetime of the registry
+    MetricsCounter &counter(const std::string &name) {return counters[name];};
+    MetricsGauge &gauge(const std::string &name) {return gauges[name];};
+    MetricsHistogram &histogram(const std::string &name) {return histograms[name];};
+
+    const std::map<std::string, MetricsCounter> &getCounters(void) const {return counters;};
+
+    // Get a scope for a new instance of something, e.g. "AXISSink" gives "AXISSink0", "AXISSink1", ...
+    inline MetricsScope instanceScope(const std::string &base);
+
+    void setName(const std::string &name_) {name = name_;};
+    const std::string &getName(void) const {return name;};
+
+    // Write all metrics out as a single JSON object (without a trailing newline)
+    void writeJson(std::ostream &os) const
+    {
+        // Default precision would turn large counts into things like 1e+07
+        auto old_precision = os.precision(15);
+
+        os << "{\"model\":";
+        writeString(os, name);
+
+        os << ",\"counters\":{";
+        writeEntries(os, counters, [](std::ostream &o, const MetricsCounter &c) {o << c.get();});
+
+        os << "},\"gauges\":{";
+        writeEntries(os, gauges, [](std::ostream &o, const MetricsGauge &g) {writeNumber(o, g.get());});
+
+        os << "},\"histograms\":{";
+        writeEntries(os, histograms, [](std::ostream &o, const MetricsHistogram &h)
+        {
+            o << "{\"count\":" << h.getCount() << ",\"sum\":";
+            writeNumber(o, h.getSum());
+            o << ",\"mean\":";
+            writeNumber(o, h.getMean());
+            o << ",\"min\":";
+            writeNumber(o, h.getCount() ? h.getMin() : 0.0);
+            o << ",\"max\":";
+            writeNumber(o, h.getCount() ? h.getMax() : 0.0);
+            o << ",\"buckets\":[";
+            bool first = true;
+            for(const auto &[value, count] : h.getBuckets())
+            {
+                o << (first ? "" : ",") << '[';
+                writeNumber(o, value);
+                o << ',' << count << ']';
+                first = false;
+            }
+            o << "]}";
+        });
+        os << "}}";
+        os.precision(old_precision);
+    }
+
+private:
+    std::string name;
+    std::map<std::string, MetricsCounter> counters;
+    std::map<std::string, MetricsGauge> gauges;
+    std::map<std::string, MetricsHistogram> histograms;
+    std::map<std::string, unsigned int> instance_counts;
+
+    static void writeString(std::ostream &os, const std::string &s)
+    {
+        os << '"';
+        for(char c : s)
+        {
+            if(c == '"' || c == '\\')
+            {
+                os << '\\' << c;
+            } else if(static_cast<unsigned char>(c) < 0x20) {
+                os << ' ';
+            } else {
+                os << c;
+            }
+        }
+        os << '"';
+    }
+
+    // JSON has no representation of inf or nan
+    static void writeNumber(std::ostream &os, double d)
+    {
+        if(d != d || d == std::numeric_limits<double>::infinity() || d == -std::numeric_limits<double>::infinity())
+        {
+            os << "null";
+        } else {
+            os << d;
+        }
+    }
+
+    template <class MapT, class F> static void writeEntries(std::ostream &os, const MapT &map, F write_value)
+    {
+        bool first = true;
+        for(const auto &[key, value] : map)
+        {
+            if(!first)
+            {
+                os << ',';
+            }
+            writeString(os, key);
+            os << ':';
+            write_value(os, value);
+            first = false;
+        }
+    }
+};
+
+// Helper to namespace the metrics of a single instance
+class MetricsScope
+{
+public:
+    MetricsScope(MetricsRegistry &registry_, std::string prefix_) :registry(registry_), prefix(std::move(prefix_)) {};
+
+    MetricsCounter &counter(const std::string &name) {return registry.counter(prefix + '.' + name);};
+    MetricsGauge &gauge(const std::string &name) {return registry.gauge(prefix + '.' + name);};
+    MetricsHistogram &histogram(const std::string &name) {return registry.histogram(prefix + '.' + name);};
+
+    const std::string &getPrefix(void) const {return prefix;};
+
+private:
+    MetricsRegistry &registry;
+    std::string prefix;
+};
+
+MetricsScope MetricsRegistry::instanceScope(const std::string &base)
+{
+    return MetricsScope(*this, base + std::to_string(instance_counts[base]++));
+}
+
+#endif
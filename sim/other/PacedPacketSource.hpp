@@ -0,0 +1,221 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef PACED_PACKET_SOURCE_HPP
+#define PACED_PACKET_SOURCE_HPP
+
+// Hold packets back from a peripheral until they are due, so they arrive at a realistic rate rather than back to back
+// Packets can be released at their captured times (e.g. from a PcapPacketSource), or at a target bit rate or packet rate,
+// either evenly spaced or as a Poisson process
+// The peripheral can only take a packet once it has finished the last one, so if the requested rate is more than it
+// can manage, packets go out late. The achieved and requested rates are both reported, so this shows up
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <gsl/pointers>
+
+#include "ClockGen.hpp"
+#include "Metrics.hpp"
+#include "PacketLease.hpp"
+#include "SimRandom.hpp"
+#include "../verilator/VerilatedModel.hpp"
+
+struct PacingConfig
+{
+    enum class Mode
+    {
+        // Keep the gaps between the packets' timestamps
+        TIMESTAMPS,
+        // Target rate in Mb/s, counting wire_bytes for each packet
+        BIT_RATE,
+        // Target rate in packets/s
+        PACKET_RATE
+    };
+
+    Mode mode = Mode::PACKET_RATE;
+    // For BIT_RATE this is Mb/s, for PACKET_RATE packets/s
+    double rate = 0;
+    // For TIMESTAMPS, the timestamp (in ns) of the packet the source has just produced, e.g. PcapPacketSource::getTimestamp
+    std::function<uint64_t(void)> timestamp = nullptr;
+    // For TIMESTAMPS, gaps are multiplied by this, so 0.5 replays at twice the captured speed
+    double time_scale = 1;
+    // For the rate modes, make the gaps exponentially distributed (with the same mean), rather than all the same
+    bool poisson = false;
+    uint64_t seed = 0;
+    // How many bytes a packet takes up, for BIT_RATE and for reporting bit rates. See ethernetWireBytes
+    std::function<size_t(size_t)> wire_bytes = [](size_t size) {return size;};
+
+    // Everything a packet takes up on an ethernet link: padding, FCS, preamble and the inter packet gap
+    // So a rate of 1000 Mb/s with this is 100% of gigabit line rate, which is what GMIISource sends back to back
+    static size_t ethernetWireBytes(size_t size)
+    {
+        return std::max<size_t>(size, 60) + 4 + 8 + 12;
+    }
+};
+
+class PacedPacketSource : public LeasePacketSource<uint8_t>
+{
+public:
+    // clk should be the clock of the peripheral taking the packets. A packet is late if it goes out more than a cycle after it was due
+    PacedPacketSource(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, AnyPacketSource<uint8_t> source_, PacingConfig config_)
+        :clk(clk_), seconds_per_tick(clk_->getResolution()), source(std::move(source_)), config(std::move(config_)),
+         random(SimRandom::deriveSeed("PacedPacketSource", config.seed)),
+         metrics(model->getMetrics().instanceScope("PacedPacketSource")),
+         packets_counter(metrics.counter("packets")),
+         wire_bytes_counter(metrics.counter("wire_bytes")),
+         late_counter(metrics.counter("late_packets")),
+         lateness_histogram(metrics.histogram("lateness_cycles"))
+    {
+        if(config.mode == PacingConfig::Mode::TIMESTAMPS ? !config.timestamp : config.rate <= 0)
+        {
+            throw std::invalid_argument("Pacing needs a timestamp function to replay timestamps, or a positive rate");
+        }
+    }
+
+    ~PacedPacketSource()
+    {
+        metrics.gauge("requested_mbps").set(getRequestedMbps());
+        metrics.gauge("achieved_mbps").set(getAchievedMbps());
+        metrics.gauge("requested_packet_rate").set(getRequestedPacketRate());
+        metrics.gauge("achieved_packet_rate").set(getAchievedPacketRate());
+    }
+
+    std::optional<PacketLease<uint8_t>> lease() override
+    {
+        if(!pending)
+        {
+            pending = source.lease();
+            if(!pending)
+            {
+                return std::nullopt;
+            }
+            schedule();
+        }
+
+        vluint64_t time = clk->getTime();
+        if(time < due)
+        {
+            return std::nullopt;
+        }
+
+        // The consumer only asks once a cycle, and not at all whilst it is busy with the last packet
+        auto lateness = std::floor((time - due) / clk->getTicksPerClock());
+        lateness_histogram.add(lateness);
+        if(lateness >= 1)
+        {
+            late_counter.increment();
+        }
+
+        if(!first_release)
+        {
+            first_release = time;
+            first_due = due;
+        } else {
+            // Don't count the last packet's bytes, as the time it takes isn't included
+            counted_wire_bytes += last_wire_bytes;
+        }
+        last_release = time;
+        last_due = due;
+        last_wire_bytes = config.wire_bytes(pending->size());
+
+        packets_counter.increment();
+        wire_bytes_counter.increment(last_wire_bytes);
+
+        auto ret = std::move(pending);
+        pending.reset();
+        return ret;
+    }
+
+    // Rates between the first and last packets, in terms of wire_bytes. Zero until two packets have been released
+    // The requested rates are what the schedule asked for, which for Poisson or replayed traffic isn't exactly the configured rate
+    double getRequestedMbps(void) const {return mbps(last_due - first_due);};
+    double getAchievedMbps(void) const {return mbps(last_release - first_release.value_or(last_release));};
+    double getRequestedPacketRate(void) const {return packetRate(last_due - first_due);};
+    double getAchievedPacketRate(void) const {return packetRate(last_release - first_release.value_or(last_release));};
+
+    vluint64_t getNumPackets(void) const {return packets_counter.get();};
+    // Packets that went out more than a cycle after they were due, because the consumer was still busy
+    vluint64_t getNumLate(void) const {return late_counter.get();};
+    const MetricsHistogram &getLateness(void) const {return lateness_histogram;};
+
+private:
+    ClockGen *clk;
+    const double seconds_per_tick;
+    AnyPacketSource<uint8_t> source;
+    PacingConfig config;
+    SimRandom random;
+
+    std::optional<PacketLease<uint8_t>> pending;
+    // In ticks. Kept as a double so rounding doesn't build up over many packets
+    double due = 0;
+    bool scheduled_any = false;
+    uint64_t first_timestamp = 0;
+    double first_timestamp_due = 0;
+
+    std::optional<vluint64_t> first_release;
+    vluint64_t last_release = 0;
+    double first_due = 0;
+    double last_due = 0;
+    size_t last_wire_bytes = 0;
+    uint64_t counted_wire_bytes = 0;
+
+    MetricsScope metrics;
+    MetricsCounter &packets_counter;
+    MetricsCounter &wire_bytes_counter;
+    MetricsCounter &late_counter;
+    MetricsHistogram &lateness_histogram;
+
+    // Work out when the pending packet is due
+    // The first packet is due straight away. After that the schedule doesn't slip if packets go out late, so the average rate is kept
+    void schedule(void)
+    {
+        vluint64_t time = clk->getTime();
+        if(config.mode == PacingConfig::Mode::TIMESTAMPS)
+        {
+            uint64_t ts = config.timestamp();
+            if(!scheduled_any)
+            {
+                first_timestamp = ts;
+                first_timestamp_due = time;
+            }
+            if(ts < first_timestamp)
+            {
+                throw std::runtime_error("Packet timestamps went backwards, before the first packet");
+            }
+            due = std::max(due, first_timestamp_due + (ts - first_timestamp) * 1e-9 * config.time_scale / seconds_per_tick);
+        } else if(!scheduled_any) {
+            due = time;
+        } else {
+            // The gap is set by the packet before
+            double gap_seconds = (config.mode == PacingConfig::Mode::BIT_RATE) ? last_wire_bytes * 8 / (config.rate * 1e6) : 1 / config.rate;
+            if(config.poisson)
+            {
+                gap_seconds *= -std::log(1 - random.nextDouble());
+            }
+            due += gap_seconds / seconds_per_tick;
+        }
+        scheduled_any = true;
+    }
+
+    double mbps(double ticks) const
+    {
+        return (ticks > 0) ? counted_wire_bytes * 8 / (ticks * seconds_per_tick) / 1e6 : 0;
+    }
+
+    double packetRate(double ticks) const
+    {
+        return (ticks > 0) ? (packets_counter.get() - 1) / (ticks * seconds_per_tick) : 0;
+    }
+};
+
+#endif
@@ -0,0 +1,308 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef PACKET_CORPUS_HPP
+#define PACKET_CORPUS_HPP
+
+// Binary file of packets, for regression stimulus and expected results that are too big (or too real) to write inline
+// Each packet has a data channel of bytes, and optionally some side channels (e.g. per beat tuser values)
+// The file is a header, the payloads, and a table giving where each packet's channels are
+// PacketCorpus memory maps the file, so opening it is instant however big it is, and processes reading the same
+// corpus share it through the page cache. PacketCorpusSource lends packets straight out of the mapping
+// N.B. Values are stored in the native byte order, so corpora should be read on the same kind of machine they were written on
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <gsl/pointers>
+
+#include "PacketLease.hpp"
+
+struct PacketCorpusException : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct PacketCorpusHeader
+{
+    static constexpr char expected_magic[8] = {'P', 'K', 'T', 'C', 'O', 'R', 'P', 'S'};
+    static constexpr uint32_t expected_version = 1;
+    static constexpr uint32_t max_channels = 16;
+
+    char magic[8];
+    uint32_t version;
+    // Channel 0 is the packet data, the rest are side channels
+    uint32_t num_channels;
+    uint64_t num_packets;
+    // Where the table starts. It has num_channels entries per packet
+    uint64_t table_offset;
+    uint32_t element_bytes[max_channels];
+};
+
+struct PacketCorpusEntry
+{
+    // From the start of the file, always a multiple of 8 so the elements are aligned
+    uint64_t offset;
+    // In elements, not bytes
+    uint64_t length;
+};
+
+// Writes a corpus with bytes of packet data, and n_users side channels of userT
+// The header and table are written when the writer is destroyed, or finish is called
+template <class userT=uint8_t, unsigned int n_users=0> class PacketCorpusWriter
+{
+public:
+    explicit PacketCorpusWriter(const std::string &filename_)
+        :filename(filename_), os(filename_, std::ios::binary | std::ios::trunc)
+    {
+        static_assert(n_users + 1 <= PacketCorpusHeader::max_channels, "Too many side channels for a packet corpus");
+        if(!os)
+        {
+            throw PacketCorpusException("Couldn't open packet corpus " + filename + ": " + strerror(errno));
+        }
+
+        // Leave room for the header, which isn't known until the end
+        PacketCorpusHeader header{};
+        write(&header, sizeof(header));
+    }
+
+    PacketCorpusWriter(const PacketCorpusWriter &) = delete;
+    PacketCorpusWriter &operator=(const PacketCorpusWriter &) = delete;
+
+    ~PacketCorpusWriter()
+    {
+        // Can't throw from here, so call finish first to find out if it worked
+        try
+        {
+            finish();
+        } catch(const PacketCorpusException &) {
+        }
+    }
+
+    void add(std::span<const uint8_t> data, const std::array<std::span<const userT>, n_users> &users=std::array<std::span<const userT>, n_users>{})
+    {
+        if(finished)
+        {
+            throw PacketCorpusException("Packet added to corpus " + filename + " after it was finished");
+        }
+
+        addChannel(data.data(), data.size(), 1);
+        for(const auto &user : users)
+        {
+            addChannel(user.data(), user.size(), sizeof(userT));
+        }
+        num_packets++;
+    }
+
+    // Write the table and header. Nothing more can be added afterwards
+    void finish(void)
+    {
+        if(finished)
+        {
+            return;
+        }
+        finished = true;
+
+        PacketCorpusHeader header{};
+        memcpy(header.magic, PacketCorpusHeader::expected_magic, sizeof(header.magic));
+        header.version = PacketCorpusHeader::expected_version;
+        header.num_channels = n_users + 1;
+        header.num_packets = num_packets;
+        header.table_offset = position;
+        header.element_bytes[0] = 1;
+        for(size_t i=1; i <= n_users; i++)
+        {
+            header.element_bytes[i] = sizeof(userT);
+        }
+
+        write(table.data(), table.size() * sizeof(PacketCorpusEntry));
+        os.seekp(0);
+        write(&header, sizeof(header));
+        os.close();
+        if(!os)
+        {
+            throw PacketCorpusException("Couldn't finish writing packet corpus " + filename);
+        }
+    }
+
+    uint64_t getNumPackets(void) const {return num_packets;};
+
+private:
+    std::string filename;
+    std::ofstream os;
+    uint64_t position = 0;
+    uint64_t num_packets = 0;
+    std::vector<PacketCorpusEntry> table;
+    bool finished = false;
+
+    void write(const void *data, size_t bytes)
+    {
+        os.write(static_cast<const char *>(data), bytes);
+        if(!os)
+        {
+            throw PacketCorpusException("Couldn't write packet corpus " + filename);
+        }
+        position += bytes;
+    }
+
+    void addChannel(const void *data, size_t length, size_t element_bytes)
+    {
+        table.push_back(PacketCorpusEntry{position, length});
+        write(data, length * element_bytes);
+
+        static constexpr char padding[8] = {};
+        write(padding, (8 - position % 8) % 8);
+    }
+};
+
+// A memory mapped corpus, written by PacketCorpusWriter
+// Any number of sources can read from it at once, but it must outlive them
+class PacketCorpus
+{
+public:
+    explicit PacketCorpus(const std::string &filename)
+    {
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            throw PacketCorpusException("Couldn't open packet corpus " + filename + ": " + strerror(errno));
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PacketCorpusHeader))
+        {
+            ::close(fd);
+            throw PacketCorpusException(filename + " is too short to be a packet corpus");
+        }
+        size = st.st_size;
+
+        map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED)
+        {
+            map = nullptr;
+            ::close(fd);
+            throw PacketCorpusException(std::string("Couldn't map packet corpus: ") + strerror(errno));
+        }
+
+        header = static_cast<const PacketCorpusHeader *>(map);
+        if(memcmp(header->magic, PacketCorpusHeader::expected_magic, sizeof(header->magic)) != 0 || header->version != PacketCorpusHeader::expected_version)
+        {
+            close();
+            throw PacketCorpusException(filename + " is not a packet corpus, or is from an unsupported version (or wasn't finished)");
+        }
+        if(header->num_channels < 1 || header->num_channels > PacketCorpusHeader::max_channels ||
+           header->table_offset > size || (size - header->table_offset) / sizeof(PacketCorpusEntry) / header->num_channels < header->num_packets)
+        {
+            close();
+            throw PacketCorpusException(filename + " has an inconsistent header");
+        }
+        table = reinterpret_cast<const PacketCorpusEntry *>(static_cast<const uint8_t *>(map) + header->table_offset);
+    }
+
+    PacketCorpus(const PacketCorpus &) = delete;
+    PacketCorpus &operator=(const PacketCorpus &) = delete;
+
+    ~PacketCorpus()
+    {
+        close();
+    }
+
+    uint64_t getNumPackets(void) const {return header->num_packets;};
+    // Including the data channel
+    uint32_t getNumChannels(void) const {return header->num_channels;};
+
+    // Channel 0 is the packet data, side channel i is channel i+1
+    // Entries are checked against the file size as they are used, rather than all up front, so opening stays instant
+    template <class T=uint8_t> std::span<const T> getPacket(uint64_t index, uint32_t channel=0) const
+    {
+        if(index >= header->num_packets || channel >= header->num_channels)
+        {
+            throw PacketCorpusException("Packet " + std::to_string(index) + " channel " + std::to_string(channel) + " is not in the corpus");
+        }
+        if(header->element_bytes[channel] != sizeof(T))
+        {
+            throw PacketCorpusException("Packet corpus channel " + std::to_string(channel) + " has " + std::to_string(header->element_bytes[channel]) + " byte elements, not " + std::to_string(sizeof(T)));
+        }
+
+        const PacketCorpusEntry &entry = table[index * header->num_channels + channel];
+        if(entry.offset % 8 != 0 || entry.offset > size || entry.length > (size - entry.offset) / sizeof(T))
+        {
+            throw PacketCorpusException("Packet " + std::to_string(index) + " runs off the end of the corpus");
+        }
+        return std::span<const T>(reinterpret_cast<const T *>(static_cast<const uint8_t *>(map) + entry.offset), entry.length);
+    }
+
+private:
+    int fd = -1;
+    void *map = nullptr;
+    size_t size = 0;
+    const PacketCorpusHeader *header = nullptr;
+    const PacketCorpusEntry *table = nullptr;
+
+    void close(void)
+    {
+        if(map)
+        {
+            munmap(map, size);
+            map = nullptr;
+        }
+        if(fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+// Lend out one channel of a corpus's packets, in order, without copying them
+// Use a source for channel 0 as the data source. Side channels can be used as tuser sources through PacketSourceFromLease
+template <class T=uint8_t> class PacketCorpusSource : public LeasePacketSource<T>
+{
+public:
+    // Serve count packets starting from first
+    PacketCorpusSource(gsl::not_null<const PacketCorpus *> corpus_, uint32_t channel_=0, uint64_t first=0, uint64_t count=std::numeric_limits<uint64_t>::max())
+        :corpus(corpus_), channel(channel_), next(first),
+         end(count < corpus_->getNumPackets() - std::min(first, corpus_->getNumPackets()) ? first + count : corpus_->getNumPackets())
+    {
+        // Check the channel has the right element type now, rather than on the first packet
+        if(next < end)
+        {
+            corpus->getPacket<T>(next, channel);
+        }
+    }
+
+    std::optional<PacketLease<T>> lease() override
+    {
+        if(next >= end)
+        {
+            return std::nullopt;
+        }
+        return PacketLease<T>(corpus->getPacket<T>(next++, channel));
+    }
+
+private:
+    const PacketCorpus *corpus;
+    uint32_t channel;
+    uint64_t next;
+    uint64_t end;
+};
+
+#endif
@@ -0,0 +1,210 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef PACKET_LEASE_HPP
+#define PACKET_LEASE_HPP
+
+// Packet sources that lend out packets, rather than returning them by value
+// A lease is a read-only view of a packet, which the source is told about when the user is done with it
+// This lets packets come straight out of mmap'd files, ring buffers etc. without being copied
+// Adapters are provided in both directions, so vector based sources and lease based sources can be used interchangeably
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include <gsl/pointers>
+
+#include "PacketPool.hpp"
+#include "PacketSourceSink.hpp"
+
+template <class T> class PacketLease
+{
+public:
+    // Called once when the lease ends, with the context and token it was created with
+    using Releaser = void (*)(void *context, uintptr_t token);
+
+    // Borrow data that the source keeps hold of until release is called
+    // If release is null, the data must outlive every user of the lease
+    explicit PacketLease(std::span<const T> data_, Releaser release_=nullptr, void *context_=nullptr, uintptr_t token_=0)
+        :view(data_), release(release_), context(context_), token(token_)
+    {
+    }
+
+    // Lend out a pooled buffer, which goes back to its pool when the lease ends
+    explicit PacketLease(PacketHandle<T> handle_)
+        :view(handle_.span()), handle(std::move(handle_))
+    {
+    }
+
+    PacketLease(PacketLease &&other) noexcept
+        :view(other.view), release(other.release), context(other.context), token(other.token), handle(std::move(other.handle))
+    {
+        other.release = nullptr;
+        other.handle.reset();
+    }
+
+    PacketLease &operator=(PacketLease &&other) noexcept
+    {
+        if(this != &other)
+        {
+            finish();
+            view = other.view;
+            release = other.release;
+            context = other.context;
+            token = other.token;
+            handle = std::move(other.handle);
+            other.release = nullptr;
+            other.handle.reset();
+        }
+        return *this;
+    }
+
+    PacketLease(const PacketLease &) = delete;
+    PacketLease &operator=(const PacketLease &) = delete;
+
+    ~PacketLease()
+    {
+        finish();
+    }
+
+    std::span<const T> span(void) const {return view;};
+    const T *data(void) const {return view.data();};
+    size_t size(void) const {return view.size();};
+    const T *begin(void) const {return view.data();};
+    const T *end(void) const {return view.data() + view.size();};
+
+private:
+    std::span<const T> view;
+    Releaser release = nullptr;
+    void *context = nullptr;
+    uintptr_t token = 0;
+    std::optional<PacketHandle<T>> handle;
+
+    void finish(void)
+    {
+        if(release)
+        {
+            release(context, token);
+            release = nullptr;
+        }
+        handle.reset();
+    }
+};
+
+template <class DataT> class LeasePacketSource
+{
+public:
+    virtual ~LeasePacketSource()=default;
+
+    // Try and borrow a packet from a packet source. The data is valid until the lease is destroyed
+    virtual std::optional<PacketLease<DataT>> lease() = 0;
+};
+
+// Lend out packets from a vector based source, via pooled buffers
+template <class T> class LeaseFromPacketSource : public LeasePacketSource<T>
+{
+public:
+    LeaseFromPacketSource(gsl::not_null<PacketSource<T> *> source_) :source(source_) {};
+
+    std::optional<PacketLease<T>> lease() override
+    {
+        auto packet = source->receivePooled(pool);
+        if(!packet)
+        {
+            return std::nullopt;
+        }
+        return PacketLease<T>(std::move(*packet));
+    }
+
+private:
+    PacketSource<T> *source;
+    PacketPool<T> pool;
+};
+
+// Turn a lease based source back into a vector based one, for code that needs to own its packets
+template <class T> class PacketSourceFromLease : public PacketSource<T>
+{
+public:
+    PacketSourceFromLease(gsl::not_null<LeasePacketSource<T> *> source_) :source(source_) {};
+
+    std::optional<std::vector<T>> receive() override
+    {
+        auto packet = source->lease();
+        if(!packet)
+        {
+            return std::nullopt;
+        }
+        return std::vector<T>(packet->begin(), packet->end());
+    }
+
+    std::optional<PacketHandle<T>> receivePooled(PacketPool<T> &pool) override
+    {
+        auto packet = source->lease();
+        if(!packet)
+        {
+            return std::nullopt;
+        }
+        return pool.acquire(packet->span());
+    }
+
+private:
+    LeasePacketSource<T> *source;
+};
+
+// Lend out packets that are owned elsewhere, one at a time, without copying them
+// The packets must outlive the source
+template <class T> class SpanPacketSource : public LeasePacketSource<T>
+{
+public:
+    SpanPacketSource(std::span<const std::vector<T>> packets_) :packets(packets_) {};
+
+    std::optional<PacketLease<T>> lease() override
+    {
+        if(next == packets.size())
+        {
+            return std::nullopt;
+        }
+        return PacketLease<T>(std::span<const T>(packets[next++]));
+    }
+
+private:
+    std::span<const std::vector<T>> packets;
+    size_t next = 0;
+};
+
+// Holds either kind of source, for peripherals to take in their constructors
+// Vector based sources are adapted to lend out packets, so the peripheral only has to deal with leases
+// Copies share the same source (and adapter)
+template <class T> class AnyPacketSource
+{
+public:
+    template <class SourceT> AnyPacketSource(SourceT *source_)
+    {
+        gsl::not_null<SourceT *> checked(source_);
+        if constexpr (std::is_base_of_v<LeasePacketSource<T>, SourceT>)
+        {
+            source = checked.get();
+        } else {
+            static_assert(std::is_base_of_v<PacketSource<T>, SourceT>, "Not a packet source");
+            adapter = std::make_shared<LeaseFromPacketSource<T>>(checked.get());
+            source = adapter.get();
+        }
+    }
+
+    std::optional<PacketLease<T>> lease(void) {return source->lease();};
+
+private:
+    std::shared_ptr<LeaseFromPacketSource<T>> adapter;
+    LeasePacketSource<T> *source;
+};
+
+#endif
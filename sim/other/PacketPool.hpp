@@ -0,0 +1,181 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef PACKET_POOL_HPP
+#define PACKET_POOL_HPP
+
+// Pool of reusable packet buffers, handed out as reference counted handles
+// When the last handle to a buffer goes away the buffer goes back to the pool, keeping its capacity
+// So once a simulation has warmed up, passing packets around does not allocate
+// Handles can be passed between threads, and can outlive the pool they came from
+// Only the thread that owns a pool acquires from it. Buffers can be released on any thread, and go back through a lock-free list,
+// so e.g. a producer filling buffers for a PacketQueue never waits on the consumer that releases them
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+template <class T> class PacketPool;
+
+template <class T> class PacketHandle
+{
+public:
+    PacketHandle(const PacketHandle &other) :node(other.node)
+    {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    PacketHandle(PacketHandle &&other) noexcept :node(other.node)
+    {
+        other.node = nullptr;
+    }
+
+    PacketHandle &operator=(PacketHandle other) noexcept
+    {
+        std::swap(node, other.node);
+        return *this;
+    }
+
+    ~PacketHandle()
+    {
+        if(node && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            PacketPool<T>::release(node);
+        }
+    }
+
+    // N.B. The buffer is shared between all copies of a handle, so only modify it if you know you have the only one
+    std::vector<T> &operator*() const {return node->data;};
+    std::vector<T> *operator->() const {return &node->data;};
+
+    std::span<T> span(void) const {return node->data;};
+    size_t size(void) const {return node->data.size();};
+    long use_count(void) const {return node->refs.load(std::memory_order_relaxed);};
+
+private:
+    friend class PacketPool<T>;
+    typename PacketPool<T>::Node *node;
+
+    explicit PacketHandle(typename PacketPool<T>::Node *node_) :node(node_) {};
+};
+
+template <class T> class PacketPool
+{
+public:
+    PacketPool() :state(std::make_shared<State>()) {};
+
+    PacketPool(const PacketPool &) = delete;
+    PacketPool &operator=(const PacketPool &) = delete;
+
+    // Get an empty buffer, reusing a returned one if possible
+    PacketHandle<T> acquire(void)
+    {
+        if(!state->cache)
+        {
+            // Take everything that has been released since we last ran out, in one go
+            state->cache = state->returned.exchange(nullptr, std::memory_order_acquire);
+        }
+
+        Node *node = state->cache;
+        if(node)
+        {
+            state->cache = node->next;
+        } else {
+            node = new Node;
+            state->num_buffers.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        node->refs.store(1, std::memory_order_relaxed);
+        node->state = state;
+        return PacketHandle<T>(node);
+    }
+
+    // Get a buffer holding a copy of some data
+    PacketHandle<T> acquire(std::span<const T> data)
+    {
+        auto handle = acquire();
+        handle->assign(data.begin(), data.end());
+        return handle;
+    }
+
+    // Total number of buffers that have been allocated, which stops growing once the simulation reaches a steady state
+    size_t getNumBuffers(void) const {return state->num_buffers.load(std::memory_order_relaxed);};
+    // Owner only
+    size_t getNumFree(void) const
+    {
+        return State::length(state->cache) + State::length(state->returned.load(std::memory_order_acquire));
+    }
+
+private:
+    friend class PacketHandle<T>;
+
+    struct State;
+
+    struct Node
+    {
+        std::atomic<long> refs{0};
+        std::vector<T> data;
+        // Only set whilst the buffer is in use, so that free buffers don't keep the state alive
+        std::shared_ptr<State> state;
+        // Next free buffer, whilst this one is free
+        Node *next = nullptr;
+    };
+
+    struct State
+    {
+        // Free buffers only the owner touches
+        Node *cache = nullptr;
+        // Free buffers released since the owner last took them. Any thread pushes onto the front
+        // Only the owner takes them, and always the whole list at once, so a compare and swap is all pushing needs
+        std::atomic<Node *> returned{nullptr};
+        std::atomic<size_t> num_buffers{0};
+
+        ~State()
+        {
+            freeList(cache);
+            freeList(returned.load(std::memory_order_acquire));
+        }
+
+        static void freeList(Node *node)
+        {
+            while(node)
+            {
+                delete std::exchange(node, node->next);
+            }
+        }
+
+        static size_t length(const Node *node)
+        {
+            size_t n = 0;
+            for(; node; node = node->next)
+            {
+                n++;
+            }
+            return n;
+        }
+    };
+
+    std::shared_ptr<State> state;
+
+    static void release(Node *node)
+    {
+        node->data.clear();
+        // If this is the last thing referring to the state, the node is freed along with it
+        auto node_state = std::move(node->state);
+        Node *head = node_state->returned.load(std::memory_order_relaxed);
+        do
+        {
+            node->next = head;
+        } while(!node_state->returned.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include <optional>
 #include <span>
 
+#include "PacketPool.hpp"
+
 template <class DataT> class PacketSource
 {
 public:
@@ -12,6 +14,19 @@ public:
 
     // Try and get a packet from a packet source
     virtual std::optional<std::vector<DataT>> receive() = 0;
+
+    // As receive(), but into a buffer from a pool
+    // The packet is copied, so that the pool's buffer (and its capacity) is reused rather than replaced by receive()'s vector
+    // Override this if the packet can be written straight into the buffer, to avoid receive() allocating as well
+    virtual std::optional<PacketHandle<DataT>> receivePooled(PacketPool<DataT> &pool)
+    {
+        auto packet = receive();
+        if(!packet)
+        {
+            return std::nullopt;
+        }
+        return pool.acquire(std::span<const DataT>(*packet));
+    }
 };
 
 template <class DataT> class PacketSink
@@ -21,6 +36,12 @@ public:
 
     // Send a packet to the sink
     virtual void send(std::span<DataT>) = 0;
+
+    // As send(), but the sink can keep hold of the buffer rather than copying it
+    virtual void sendPooled(PacketHandle<DataT> packet)
+    {
+        send(packet.span());
+    }
 };
 
 
@@ -30,7 +51,7 @@ public:
 template <class T> class SimplePacketSource : public PacketSource<T>
 {
 public:
-    SimplePacketSource(std::vector<std::vector<uint8_t>> data_) : data(data_){};
+    SimplePacketSource(std::vector<std::vector<T>> data_) : data(data_){};
 
     std::optional<std::vector<T>> receive() override
     {
@@ -42,6 +63,15 @@ public:
         return ret;
     };
 
+    std::optional<PacketHandle<T>> receivePooled(PacketPool<T> &pool) override
+    {
+        if(iter == data.end())
+        {
+            return std::nullopt;
+        }
+        return pool.acquire(*(iter++));
+    };
+
 private:
     std::vector<std::vector<T>> data;
     typename std::vector<std::vector<T>>::const_iterator iter = data.begin();
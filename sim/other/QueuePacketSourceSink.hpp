@@ -0,0 +1,259 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef QUEUE_PACKET_SOURCE_SINK_HPP
+#define QUEUE_PACKET_SOURCE_SINK_HPP
+
+// Pass packets between the simulation and other threads, e.g. a traffic generator feeding the simulation,
+// or a checker draining its output, without the simulation having to wait for them
+// A PacketQueue is a bounded lock-free queue of pooled packet handles, with one thread pushing and one popping
+// QueuePacketSource pops from a queue (so the simulation is the consumer) and QueuePacketSink pushes to one (the simulation is the producer)
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gsl/pointers>
+
+#include "PacketPool.hpp"
+#include "PacketSourceSink.hpp"
+#include "SpscQueue.hpp"
+
+struct PacketQueueException : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// What to do when pushing to a full queue, or popping from an empty one
+// BLOCK waits for the other side (either stops waiting once the queue is closed)
+// DROP discards the packet being pushed, or returns nothing from the pop, and counts it
+// REPORT throws a PacketQueueException
+enum class PacketQueuePolicy {BLOCK, DROP, REPORT};
+
+struct PacketQueueConfig
+{
+    size_t capacity = 1024;
+    PacketQueuePolicy full_policy = PacketQueuePolicy::BLOCK;
+    PacketQueuePolicy empty_policy = PacketQueuePolicy::DROP;
+};
+
+// Snapshot of what has happened to a queue
+struct PacketQueueStats
+{
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    // Pushes that found the queue full, and pops that found it empty (whatever the policy did about it)
+    uint64_t full = 0;
+    uint64_t empty = 0;
+    // Packets thrown away because the queue was full
+    uint64_t dropped = 0;
+    size_t max_occupancy = 0;
+    // Mean number of packets in the queue, as seen by each pop
+    double mean_occupancy = 0;
+};
+
+template <class T> class PacketQueue
+{
+public:
+    explicit PacketQueue(PacketQueueConfig config_=PacketQueueConfig{})
+        :config(config_), queue(config_.capacity)
+    {
+    }
+
+    // Producer side
+
+    // Returns whether the packet went into the queue
+    bool push(PacketHandle<T> packet)
+    {
+        if(queue.tryPush(packet))
+        {
+            pushed();
+            return true;
+        }
+
+        full.fetch_add(1, std::memory_order_relaxed);
+        switch(config.full_policy)
+        {
+            case PacketQueuePolicy::BLOCK:
+                while(!queue.tryPush(packet))
+                {
+                    // The consumer has given up, so nothing will ever make room
+                    if(isClosed())
+                    {
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    std::this_thread::yield();
+                }
+                pushed();
+                return true;
+            case PacketQueuePolicy::DROP:
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case PacketQueuePolicy::REPORT:
+                break;
+        }
+        throw PacketQueueException("Packet queue is full");
+    }
+
+    // Copy the data into a buffer from the queue's pool, then push it
+    bool push(std::span<const T> data)
+    {
+        return push(pool.acquire(data));
+    }
+
+    // The producer has finished, so a blocked pop can give up once the queue is empty
+    // Or the consumer has stopped, so a blocked push gives up. Either side can close the queue
+    void close(void)
+    {
+        closed.store(true, std::memory_order_release);
+    }
+
+    // Buffers for the producer to fill in before pushing them, to avoid copying. Producer thread only
+    PacketPool<T> &getPool(void) {return pool;};
+
+    // Consumer side
+
+    std::optional<PacketHandle<T>> pop(void)
+    {
+        auto packet = queue.tryPop();
+        if(!packet)
+        {
+            empty.fetch_add(1, std::memory_order_relaxed);
+            switch(config.empty_policy)
+            {
+                case PacketQueuePolicy::BLOCK:
+                    // Check the queue again after seeing it closed, in case the last packet went in just before
+                    while(!(packet = queue.tryPop()) && !isClosed())
+                    {
+                        std::this_thread::yield();
+                    }
+                    if(!packet)
+                    {
+                        packet = queue.tryPop();
+                    }
+                    break;
+                case PacketQueuePolicy::DROP:
+                    break;
+                case PacketQueuePolicy::REPORT:
+                    if(!isClosed())
+                    {
+                        throw PacketQueueException("Packet queue is empty");
+                    }
+                    break;
+            }
+            if(!packet)
+            {
+                return std::nullopt;
+            }
+        }
+
+        // Occupancy including the packet just popped
+        occupancy_sum.fetch_add(queue.size() + 1, std::memory_order_relaxed);
+        popped.fetch_add(1, std::memory_order_relaxed);
+        return packet;
+    }
+
+    bool isClosed(void) const {return closed.load(std::memory_order_acquire);};
+
+    // Either side
+
+    size_t size(void) const {return queue.size();};
+
+    PacketQueueStats getStats(void) const
+    {
+        PacketQueueStats stats;
+        stats.pushed = num_pushed.load(std::memory_order_relaxed);
+        stats.popped = popped.load(std::memory_order_relaxed);
+        stats.full = full.load(std::memory_order_relaxed);
+        stats.empty = empty.load(std::memory_order_relaxed);
+        stats.dropped = dropped.load(std::memory_order_relaxed);
+        stats.max_occupancy = max_occupancy.load(std::memory_order_relaxed);
+        stats.mean_occupancy = stats.popped ? static_cast<double>(occupancy_sum.load(std::memory_order_relaxed)) / stats.popped : 0;
+        return stats;
+    }
+
+private:
+    PacketQueueConfig config;
+    PacketPool<T> pool;
+    SpscQueue<PacketHandle<T>> queue;
+    std::atomic<bool> closed{false};
+
+    // Only written by the producer
+    std::atomic<uint64_t> num_pushed{0};
+    std::atomic<uint64_t> full{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<size_t> max_occupancy{0};
+    // Only written by the consumer
+    std::atomic<uint64_t> popped{0};
+    std::atomic<uint64_t> empty{0};
+    std::atomic<uint64_t> occupancy_sum{0};
+
+    void pushed(void)
+    {
+        num_pushed.fetch_add(1, std::memory_order_relaxed);
+        size_t occupancy = queue.size();
+        if(occupancy > max_occupancy.load(std::memory_order_relaxed))
+        {
+            max_occupancy.store(occupancy, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Feed a simulation from another thread
+// Runs out of packets once the queue is closed and empty, or whenever it is empty if the empty policy is DROP
+template <class T> class QueuePacketSource : public PacketSource<T>
+{
+public:
+    QueuePacketSource(gsl::not_null<PacketQueue<T> *> queue_) :queue(queue_) {};
+
+    std::optional<std::vector<T>> receive() override
+    {
+        auto packet = queue->pop();
+        if(!packet)
+        {
+            return std::nullopt;
+        }
+        return std::vector<T>(packet->span().begin(), packet->span().end());
+    }
+
+    // The handle came from the queue's pool, so can be passed straight on
+    std::optional<PacketHandle<T>> receivePooled(PacketPool<T> &) override
+    {
+        return queue->pop();
+    }
+
+private:
+    PacketQueue<T> *queue;
+};
+
+// Drain a simulation's output to another thread
+template <class T> class QueuePacketSink : public PacketSink<T>
+{
+public:
+    QueuePacketSink(gsl::not_null<PacketQueue<T> *> queue_) :queue(queue_) {};
+
+    void send(std::span<T> data) override
+    {
+        queue->push(std::span<const T>(data));
+    }
+
+    void sendPooled(PacketHandle<T> packet) override
+    {
+        queue->push(std::move(packet));
+    }
+
+private:
+    PacketQueue<T> *queue;
+};
+
+#endif
@@ -0,0 +1,290 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef SCOREBOARD_SINK_HPP
+#define SCOREBOARD_SINK_HPP
+
+// Packet sink that checks each packet against what was expected as it arrives
+// Only the counters and the mismatches are kept, so memory use doesn't grow with the length of the test
+// Expected packets come from a packet source, or from a reference model callback
+// Packets can be matched in order, or out of order by a key (e.g. a sequence number or flow ID pulled out of the packet)
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "PacketLease.hpp"
+#include "PacketSourceSink.hpp"
+
+struct ScoreboardException : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct ScoreboardConfig
+{
+    enum class Order {IN_ORDER, KEYED};
+    Order order = Order::IN_ORDER;
+    // Throw a ScoreboardException at the first mismatch, rather than carrying on
+    bool fail_fast = false;
+    // Only the first this many mismatches are kept, later ones are just counted
+    size_t max_mismatches = 16;
+    // When keyed, how many expected packets can be held waiting for their match before it is treated as an error
+    size_t max_pending = 1024;
+};
+
+struct ScoreboardMismatch
+{
+    // Index of the received packet. For expected packets that were never received, the number missing before this one
+    size_t packet_index;
+    std::string description;
+};
+
+template <class T> class ScoreboardSink : public PacketSink<T>
+{
+public:
+    using KeyFunction = std::function<uint64_t(std::span<const T>)>;
+    using ReferenceModel = std::function<std::optional<std::vector<T>>(void)>;
+
+    ScoreboardSink(AnyPacketSource<T> expected_, ScoreboardConfig config_=ScoreboardConfig{}, KeyFunction key_=nullptr)
+        :expected(std::move(expected_)), config(config_), key(std::move(key_))
+    {
+        checkKey();
+    }
+
+    // The reference model is called each time another expected packet is needed, and returns nullopt once there are no more
+    ScoreboardSink(ReferenceModel model_, ScoreboardConfig config_=ScoreboardConfig{}, KeyFunction key_=nullptr)
+        :model_source(std::make_unique<ModelSource>(std::move(model_))), expected(model_source.get()), config(config_), key(std::move(key_))
+    {
+        checkKey();
+    }
+
+    void send(std::span<T> data) override
+    {
+        std::span<const T> actual(data);
+        size_t index = num_received++;
+
+        if(config.order == ScoreboardConfig::Order::IN_ORDER)
+        {
+            auto packet = expected.lease();
+            if(!packet)
+            {
+                mismatch(index, "Unexpected packet, no more were expected\n" + dump("Received", actual));
+                return;
+            }
+            num_expected++;
+            compare(index, packet->span(), actual);
+        } else {
+            matchKeyed(index, actual);
+        }
+    }
+
+    // Call at the end of the test. Any expected packets that haven't been received count as missing
+    void finish(void)
+    {
+        for(auto &[packet_key, packets] : pending)
+        {
+            for(auto &packet : packets)
+            {
+                missingPacket(packet.span());
+            }
+        }
+        pending.clear();
+        num_pending = 0;
+
+        while(auto packet = expected.lease())
+        {
+            num_expected++;
+            missingPacket(packet->span());
+        }
+    }
+
+    bool passed(void) const {return num_mismatched == 0;};
+
+    size_t getNumReceived(void) const {return num_received;};
+    size_t getNumExpected(void) const {return num_expected;};
+    size_t getNumMatched(void) const {return num_matched;};
+    size_t getNumMismatched(void) const {return num_mismatched;};
+    const std::vector<ScoreboardMismatch> &getMismatches(void) const {return mismatches;};
+
+    // Summary of the counters and the stored mismatches, for printing when a test fails
+    std::string report(void) const
+    {
+        std::ostringstream msg;
+        msg << "Scoreboard: " << num_received << " received, " << num_expected << " expected, " << num_matched << " matched, " << num_mismatched << " mismatched\n";
+        for(const auto &m : mismatches)
+        {
+            msg << "Packet " << m.packet_index << ": " << m.description;
+        }
+        if(num_mismatched > mismatches.size())
+        {
+            msg << "(" << num_mismatched - mismatches.size() << " further mismatches not stored)\n";
+        }
+        return msg.str();
+    }
+
+private:
+    class ModelSource : public PacketSource<T>
+    {
+    public:
+        ModelSource(ReferenceModel model_) :model(std::move(model_)) {};
+        std::optional<std::vector<T>> receive() override {return model();};
+    private:
+        ReferenceModel model;
+    };
+
+    std::unique_ptr<ModelSource> model_source;
+    AnyPacketSource<T> expected;
+    ScoreboardConfig config;
+    KeyFunction key;
+
+    // Keyed mode only. Expected packets that have been pulled from the source, but not matched yet
+    // Pooled, so once the test is running the copies don't allocate
+    std::unordered_map<uint64_t, std::deque<PacketHandle<T>>> pending;
+    size_t num_pending = 0;
+    PacketPool<T> pool;
+
+    size_t num_received = 0;
+    size_t num_expected = 0;
+    size_t num_matched = 0;
+    size_t num_mismatched = 0;
+    size_t num_missing = 0;
+    std::vector<ScoreboardMismatch> mismatches;
+
+    // Words either side of the first difference to show
+    static constexpr size_t dump_context = 16;
+
+    void checkKey(void)
+    {
+        if(config.order == ScoreboardConfig::Order::KEYED && !key)
+        {
+            throw ScoreboardException("Keyed scoreboard needs a key function");
+        }
+    }
+
+    void matchKeyed(size_t index, std::span<const T> actual)
+    {
+        uint64_t packet_key = key(actual);
+
+        // Oldest expected packet with the same key, if one has already been pulled from the source
+        auto iter = pending.find(packet_key);
+        if(iter != pending.end())
+        {
+            compare(index, iter->second.front().span(), actual);
+            iter->second.pop_front();
+            if(iter->second.empty())
+            {
+                pending.erase(iter);
+            }
+            num_pending--;
+            return;
+        }
+
+        // Otherwise pull expected packets until it turns up, holding on to the ones for other keys
+        while(auto packet = expected.lease())
+        {
+            num_expected++;
+            uint64_t expected_key = key(packet->span());
+            if(expected_key == packet_key)
+            {
+                compare(index, packet->span(), actual);
+                return;
+            }
+
+            if(num_pending == config.max_pending)
+            {
+                throw ScoreboardException("Scoreboard has " + std::to_string(num_pending) + " expected packets waiting for a match, the received packets have probably been lost or have the wrong key");
+            }
+            pending[expected_key].push_back(pool.acquire(packet->span()));
+            num_pending++;
+        }
+
+        std::ostringstream msg;
+        msg << "Unexpected packet with key 0x" << std::hex << packet_key << ", no matching packet expected\n";
+        mismatch(index, msg.str() + dump("Received", actual));
+    }
+
+    void compare(size_t index, std::span<const T> expected_packet, std::span<const T> actual)
+    {
+        if(std::equal(expected_packet.begin(), expected_packet.end(), actual.begin(), actual.end()))
+        {
+            num_matched++;
+            return;
+        }
+        mismatch(index, diff(expected_packet, actual));
+    }
+
+    void missingPacket(std::span<const T> packet)
+    {
+        mismatch(num_missing++, "Expected packet never received\n" + dump("Expected", packet));
+    }
+
+    void mismatch(size_t index, std::string description)
+    {
+        num_mismatched++;
+        if(config.fail_fast)
+        {
+            throw ScoreboardException("Scoreboard mismatch at packet " + std::to_string(index) + ": " + description);
+        }
+        if(mismatches.size() < config.max_mismatches)
+        {
+            mismatches.push_back(ScoreboardMismatch{index, std::move(description)});
+        }
+    }
+
+    static std::string diff(std::span<const T> expected_packet, std::span<const T> actual)
+    {
+        auto [e, a] = std::mismatch(expected_packet.begin(), expected_packet.end(), actual.begin(), actual.end());
+        size_t first = e - expected_packet.begin();
+
+        std::ostringstream msg;
+        msg << "Expected " << expected_packet.size() << " words, received " << actual.size() << ", first difference at word " << first << "\n";
+        msg << dump("Expected", expected_packet, first);
+        msg << dump("Received", actual, first);
+        return msg.str();
+    }
+
+    // Hex dump of the start of a packet, or of the packet around a word, marking that word
+    static std::string dump(const char *name, std::span<const T> packet, std::optional<size_t> mark=std::nullopt)
+    {
+        size_t centre = mark.value_or(0);
+        size_t start = centre - std::min(centre, dump_context);
+        size_t stop = std::min(packet.size(), centre + dump_context);
+
+        std::ostringstream msg;
+        msg << "  " << name << ":";
+        if(start != 0)
+        {
+            msg << " ...";
+        }
+        msg << std::hex << std::setfill('0');
+        for(size_t i=start; i < stop; i++)
+        {
+            msg << ((i == mark) ? " [" : " ") << std::setw(sizeof(T) * 2) << static_cast<uint64_t>(packet[i]) << ((i == mark) ? "]" : "");
+        }
+        if(stop != packet.size())
+        {
+            msg << " ...";
+        }
+        msg << "\n";
+        return msg.str();
+    }
+};
+
+#endif
@@ -0,0 +1,127 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef SIGNAL_PROBE_HPP
+#define SIGNAL_PROBE_HPP
+
+// Sample a verilated signal on a clock edge and gather statistics about it
+// Intended for things like FIFO occupancy, where the distribution is more useful than a waveform
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+#include "ClockGen.hpp"
+#include "Metrics.hpp"
+#include "../verilator/Peripheral.hpp"
+#include "../verilator/VerilatedModel.hpp"
+
+struct SignalProbeConfig
+{
+    ClockGen::Event edge = ClockGen::Event::RISING;
+    // Store every nth sample in the time series. Zero disables the time series
+    unsigned int decimation = 0;
+    // If provided, samples are not taken whilst this is low
+    vluint8_t *sresetn = nullptr;
+};
+
+template <class T> class SignalProbe : public Peripheral
+{
+    static_assert(std::is_arithmetic_v<T>, "SignalProbe only supports scalar signals");
+public:
+    struct Sample
+    {
+        vluint64_t time;
+        T value;
+    };
+
+    SignalProbe(gsl::not_null<VerilatedModelInterface *> model, gsl::not_null<ClockGen *> clk_, gsl::not_null<const T *> signal_, SignalProbeConfig config_=SignalProbeConfig{})
+        :Peripheral(model), clk(clk_), signal(this, signal_), sresetn(this, config_.sresetn, true), edge(config_.edge), decimation(config_.decimation),
+         histogram(model->getMetrics().instanceScope("SignalProbe").histogram("value"))
+    {
+    };
+
+    void eval(void) override
+    {
+        if((clk->getEvent() == edge) && sresetn)
+        {
+            T value = signal;
+
+            if(decimation && ((count % decimation) == 0))
+            {
+                time_series.push_back(Sample{clk->getTime(), value});
+            }
+            buckets[value]++;
+            count++;
+            min = min ? std::min(*min, value) : value;
+            max = max ? std::max(*max, value) : value;
+            histogram.add(value);
+        }
+    }
+
+    // Forget everything that has been sampled so far
+    void clear(void)
+    {
+        histogram.clear();
+        time_series.clear();
+        buckets.clear();
+        count = 0;
+        min.reset();
+        max.reset();
+    }
+
+    // The histogram lives in the model's metrics registry, so it is also exported with the other metrics
+    // It holds values as doubles, so wide signals are only exact up to 2^53. The getters below are always exact
+    const MetricsHistogram &getHistogram(void) const {return histogram;};
+    const std::vector<Sample> &getTimeSeries(void) const {return time_series;};
+    const std::map<T, uint64_t> &getBuckets(void) const {return buckets;};
+    vluint64_t getNumSamples(void) const {return count;};
+    // Empty until at least one sample has been taken
+    std::optional<T> getMin(void) const {return min;};
+    std::optional<T> getMax(void) const {return max;};
+    double getMean(void) const {return histogram.getMean();};
+
+    // Export as CSV so that results can be plotted after the run
+    void writeHistogramCsv(std::ostream &os) const
+    {
+        os << "value,count\n";
+        for(const auto &[value, n] : buckets)
+        {
+            os << +value << ',' << n << '\n';
+        }
+    }
+
+    void writeTimeSeriesCsv(std::ostream &os) const
+    {
+        os << "time,value\n";
+        for(const auto &sample : time_series)
+        {
+            os << sample.time << ',' << +sample.value << '\n';
+        }
+    }
+
+private:
+    ClockGen *clk;
+    InputLatch<T> signal;
+    InputLatch<vluint8_t> sresetn;
+
+    const ClockGen::Event edge;
+    const unsigned int decimation;
+
+    MetricsHistogram &histogram;
+    std::vector<Sample> time_series;
+    std::map<T, uint64_t> buckets;
+    uint64_t count = 0;
+    std::optional<T> min;
+    std::optional<T> max;
+};
+
+#endif
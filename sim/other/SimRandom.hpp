@@ -0,0 +1,92 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef SIM_RANDOM_HPP
+#define SIM_RANDOM_HPP
+
+// Deterministic random number generator for stimulus (xoshiro256**)
+// Unlike rand(), each user has its own stream, so results don't depend on what else is running
+// Seeds are derived from a global seed (set by the test harness) and the name of the user,
+// so a single test case re-run on its own gets exactly the same numbers as it did in a full run
+
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+class SimRandom
+{
+public:
+    using result_type = uint64_t;
+
+    explicit SimRandom(uint64_t seed)
+    {
+        // Expand the seed with splitmix64, as recommended for xoshiro
+        for(auto &s : state)
+        {
+            seed = splitmix64(seed);
+            s = seed;
+        }
+    }
+
+    static constexpr result_type min(void) {return 0;};
+    static constexpr result_type max(void) {return std::numeric_limits<result_type>::max();};
+
+    result_type operator()(void)
+    {
+        const uint64_t result = rotl(state[1] * 5, 7) * 9;
+        const uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    bool nextBool(void) {return (*this)() >> 63;};
+
+    // Uniform in [0, 1)
+    double nextDouble(void) {return ((*this)() >> 11) * 0x1.0p-53;};
+
+    // Uniform in [0, n). Uses the multiply-shift method, bias is negligible for the sizes used in testbenches
+    uint64_t nextBelow(uint64_t n) {return static_cast<uint64_t>((static_cast<unsigned __int128>((*this)()) * n) >> 64);};
+
+    static void setGlobalSeed(uint64_t seed) {global_seed = seed;};
+    static uint64_t getGlobalSeed(void) {return global_seed;};
+
+    // Seed for a named user, e.g. the instance name of a peripheral, optionally perturbed by a user provided seed
+    static uint64_t deriveSeed(std::string_view name, uint64_t seed=0)
+    {
+        // FNV-1a
+        uint64_t hash = 0xcbf29ce484222325;
+        for(char c : name)
+        {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+        }
+        return splitmix64(global_seed ^ splitmix64(hash ^ splitmix64(seed)));
+    }
+
+private:
+    uint64_t state[4];
+
+    static inline uint64_t global_seed = 0;
+
+    static uint64_t rotl(uint64_t x, int k) {return (x << k) | (x >> (64 - k));};
+
+    static uint64_t splitmix64(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+};
+
+#endif
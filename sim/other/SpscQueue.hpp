@@ -0,0 +1,86 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+// Bounded lock-free queue, for exactly one producer thread and one consumer thread
+// Neither side ever waits on the other, tryPush and tryPop just fail if the queue is full or empty
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <optional>
+
+template <class T> class SpscQueue
+{
+public:
+    // The capacity is rounded up to a power of 2
+    explicit SpscQueue(size_t capacity_)
+        :capacity(std::bit_ceil(std::max<size_t>(capacity_, 1))), mask(capacity - 1), slots(std::make_unique<std::optional<T>[]>(capacity))
+    {
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer only. Leaves value alone and returns false if the queue is full
+    bool tryPush(T &value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head_cache == capacity)
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            if(t - head_cache == capacity)
+            {
+                return false;
+            }
+        }
+        slots[t & mask].emplace(std::move(value));
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    std::optional<T> tryPop(void)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail_cache)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if(h == tail_cache)
+            {
+                return std::nullopt;
+            }
+        }
+        std::optional<T> ret = std::move(slots[h & mask]);
+        slots[h & mask].reset();
+        head.store(h + 1, std::memory_order_release);
+        return ret;
+    }
+
+    // Approximate if called whilst the other side is running
+    size_t size(void) const {return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);};
+    size_t getCapacity(void) const {return capacity;};
+
+private:
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<std::optional<T>[]> slots;
+
+    // Each side has its index on its own cache line, along with its cached copy of the other side's index
+    // The cached copy is only refreshed when the queue looks full/empty, so the sides rarely touch each other's cache line
+    alignas(64) std::atomic<size_t> head{0};
+    size_t tail_cache = 0;
+    alignas(64) std::atomic<size_t> tail{0};
+    size_t head_cache = 0;
+};
+
+#endif
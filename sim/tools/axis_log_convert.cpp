@@ -0,0 +1,201 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+// Convert an AXIS beat log (see AxisBeatLog.hpp) to VCD or CSV
+// Usage: axis_log_convert <log> <output.vcd|output.csv> [timescale]
+// The VCD timescale comes from the tick resolution recorded in the log, so the times line up with traces of the model
+// Giving a timescale overrides it, and the times are written as they are
+
+#include "../axis/AxisBeatLog.hpp"
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+
+// Print a little endian value as hex, most significant byte first
+static void writeHex(std::ostream &os, const uint8_t *bytes, uint32_t n)
+{
+    static const char digits[] = "0123456789abcdef";
+    for(uint32_t i=n; i > 0; i--)
+    {
+        os << digits[bytes[i-1] >> 4] << digits[bytes[i-1] & 0xF];
+    }
+}
+
+// VCD vectors are written in binary, leading zeros can be dropped
+static void writeBinary(std::ostream &os, const uint8_t *bytes, uint32_t n)
+{
+    os << 'b';
+    bool seen_one = false;
+    for(uint32_t i=n*8; i > 0; i--)
+    {
+        bool bit = bytes[(i-1) / 8] & (1 << ((i-1) % 8));
+        seen_one |= bit;
+        if(seen_one)
+        {
+            os << (bit ? '1' : '0');
+        }
+    }
+    if(!seen_one)
+    {
+        os << '0';
+    }
+}
+
+static void writeCsv(const AxisBeatLogReader &log, std::ostream &os)
+{
+    const auto &layout = log.getLayout();
+
+    os << "time,tlast,tdata,tkeep";
+    for(uint32_t u=0; u < layout.n_users; u++)
+    {
+        os << ",tuser" << u;
+    }
+    os << '\n';
+
+    for(uint64_t i=0; i < log.getNumRecords(); i++)
+    {
+        os << log.getTime(i) << ',' << log.getLast(i) << ",0x";
+        writeHex(os, log.getData(i), layout.data_bytes);
+        os << ",0x";
+        writeHex(os, log.getKeep(i), layout.keep_bytes);
+        for(uint32_t u=0; u < layout.n_users; u++)
+        {
+            os << ",0x";
+            writeHex(os, log.getUser(i, u), layout.user_bytes);
+        }
+        os << '\n';
+    }
+}
+
+struct VcdTimescale
+{
+    std::string timescale;
+    // VCD time steps per tick of the log
+    uint64_t steps_per_tick = 1;
+};
+
+// A VCD timescale is 1, 10 or 100 of a unit, so use the coarsest power of 10 that the resolution is a whole number of
+// e.g. 1e-9 gives 1ns with the times as they are, 2e-9 gives 1ns with the times doubled
+static std::optional<VcdTimescale> timescaleFor(double resolution)
+{
+    static const char *units[] = {"s", "ms", "us", "ns", "ps", "fs"};
+    for(int exponent=0; exponent >= -15; exponent--)
+    {
+        double steps = resolution / std::pow(10.0, exponent);
+        uint64_t whole = std::llround(steps);
+        // Nothing finer than 1fs, so take the nearest there
+        if(whole >= 1 && (std::abs(steps - whole) <= 1e-6 * steps || exponent == -15))
+        {
+            int unit = (2 - exponent) / 3;
+            return VcdTimescale{std::to_string(static_cast<uint64_t>(std::pow(10.0, 3 * unit + exponent) + 0.5)) + units[unit], whole};
+        }
+    }
+    return std::nullopt;
+}
+
+static void writeVcd(const AxisBeatLogReader &log, std::ostream &os, const std::string &scope, const VcdTimescale &timescale)
+{
+    const auto &layout = log.getLayout();
+
+    // Identifier codes: beat strobe, tlast, tdata, tkeep, then the tusers
+    auto code = [](uint32_t n) {return std::string(1, static_cast<char>('!' + n));};
+
+    os << "$timescale " << timescale.timescale << " $end\n";
+    os << "$scope module " << scope << " $end\n";
+    os << "$var wire 1 " << code(0) << " beat $end\n";
+    os << "$var wire 1 " << code(1) << " tlast $end\n";
+    os << "$var wire " << layout.data_bytes * 8 << ' ' << code(2) << " tdata [" << layout.data_bytes * 8 - 1 << ":0] $end\n";
+    os << "$var wire " << layout.keep_bytes * 8 << ' ' << code(3) << " tkeep [" << layout.keep_bytes * 8 - 1 << ":0] $end\n";
+    for(uint32_t u=0; u < layout.n_users; u++)
+    {
+        os << "$var wire " << layout.user_bytes * 8 << ' ' << code(4 + u) << " tuser" << u << " [" << layout.user_bytes * 8 - 1 << ":0] $end\n";
+    }
+    os << "$upscope $end\n";
+    os << "$enddefinitions $end\n";
+    os << "#0\n0" << code(0) << '\n';
+
+    for(uint64_t i=0; i < log.getNumRecords(); i++)
+    {
+        uint64_t time = log.getTime(i);
+        os << '#' << time * timescale.steps_per_tick << '\n';
+        os << '1' << code(0) << '\n';
+        os << (log.getLast(i) ? '1' : '0') << code(1) << '\n';
+        writeBinary(os, log.getData(i), layout.data_bytes);
+        os << ' ' << code(2) << '\n';
+        writeBinary(os, log.getKeep(i), layout.keep_bytes);
+        os << ' ' << code(3) << '\n';
+        for(uint32_t u=0; u < layout.n_users; u++)
+        {
+            writeBinary(os, log.getUser(i, u), layout.user_bytes);
+            os << ' ' << code(4 + u) << '\n';
+        }
+
+        // The beat strobe shows one tick per beat, unless the next beat is straight after
+        if(i + 1 == log.getNumRecords() || log.getTime(i + 1) > time + 1)
+        {
+            os << '#' << (time + 1) * timescale.steps_per_tick << '\n';
+            os << '0' << code(0) << '\n';
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " <log> <output.vcd|output.csv> [timescale]" << std::endl;
+        return 1;
+    }
+
+    std::filesystem::path input(argv[1]);
+    std::filesystem::path output(argv[2]);
+
+    try
+    {
+        AxisBeatLogReader log(input.string());
+
+        std::optional<VcdTimescale> timescale;
+        if(argc == 4)
+        {
+            timescale = VcdTimescale{argv[3]};
+        } else if(log.getResolution() > 0) {
+            timescale = timescaleFor(log.getResolution());
+        }
+        if(output.extension() == ".vcd" && !timescale)
+        {
+            std::cerr << input << " doesn't record a usable tick resolution, so a timescale must be given" << std::endl;
+            return 1;
+        }
+
+        std::ofstream os(output);
+        if(!os)
+        {
+            std::cerr << "Couldn't open " << output << std::endl;
+            return 1;
+        }
+
+        if(output.extension() == ".csv")
+        {
+            writeCsv(log, os);
+        } else if(output.extension() == ".vcd") {
+            writeVcd(log, os, input.stem().string(), *timescale);
+        } else {
+            std::cerr << "Unknown output format " << output.extension() << ", expected .vcd or .csv" << std::endl;
+            return 1;
+        }
+    } catch(const AxisBeatLogException &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
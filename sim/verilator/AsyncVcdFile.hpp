@@ -0,0 +1,156 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef ASYNC_VCD_FILE_HPP
+#define ASYNC_VCD_FILE_HPP
+
+// Backend for VerilatedVcdC which buffers trace data in memory and writes it to disk from a background thread
+// Data is handed to the writer once a size threshold is reached, or after a time interval, whichever is first
+// Everything outstanding is written out on close(), which the destructor calls
+
+#include "verilated_vcd_c.h"
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class AsyncVcdFile : public VerilatedVcdFile
+{
+public:
+    AsyncVcdFile(size_t flush_bytes_, std::chrono::milliseconds flush_interval_)
+        :flush_bytes(flush_bytes_), max_pending(flush_bytes_ * 8), flush_interval(flush_interval_)
+    {
+    }
+
+    ~AsyncVcdFile() override
+    {
+        close();
+    }
+
+    bool open(const std::string &name) override
+    {
+        fd = ::open(name.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+        if(fd < 0)
+        {
+            return false;
+        }
+
+        stopping = false;
+        write_failed = false;
+        writer = std::thread(&AsyncVcdFile::writerLoop, this);
+        return true;
+    }
+
+    void close() override
+    {
+        if(!writer.joinable())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        data_cv.notify_one();
+        writer.join();
+
+        ::close(fd);
+        fd = -1;
+    }
+
+    ssize_t write(const char *bufp, ssize_t len) override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // Don't let the simulation get too far ahead of the disk
+        space_cv.wait(lock, [this]{return (pending.size() < max_pending) || write_failed;});
+
+        pending.insert(pending.end(), bufp, bufp + len);
+        if(pending.size() >= flush_bytes)
+        {
+            data_cv.notify_one();
+        }
+        return len;
+    }
+
+private:
+    const size_t flush_bytes;
+    const size_t max_pending;
+    const std::chrono::milliseconds flush_interval;
+
+    int fd = -1;
+    std::thread writer;
+
+    // Everything below is protected by mutex
+    std::mutex mutex;
+    std::condition_variable data_cv;
+    std::condition_variable space_cv;
+    std::vector<char> pending;
+    bool stopping = false;
+    bool write_failed = false;
+
+    void writerLoop(void)
+    {
+        std::vector<char> to_write;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            data_cv.wait_for(lock, flush_interval, [this]{return stopping || (pending.size() >= flush_bytes);});
+
+            // Swap buffers so that the simulation can carry on whilst we write
+            to_write.swap(pending);
+            bool stop = stopping;
+            lock.unlock();
+            space_cv.notify_one();
+
+            writeAll(to_write);
+            to_write.clear();
+
+            lock.lock();
+            if(stop && pending.empty())
+            {
+                break;
+            }
+        }
+    }
+
+    void writeAll(const std::vector<char> &buf)
+    {
+        const char *ptr = buf.data();
+        size_t remaining = buf.size();
+        while(remaining && !write_failed)
+        {
+            ssize_t ret = ::write(fd, ptr, remaining);
+            if(ret < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                // Nothing sensible to throw to on this thread, so report and discard the rest of the trace
+                std::cerr << "AsyncVcdFile: Writing trace failed. Discarding remaining trace data" << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                write_failed = true;
+                space_cv.notify_one();
+                break;
+            }
+            ptr += ret;
+            remaining -= ret;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef FLIGHT_RECORDER_VCD_FILE_HPP
+#define FLIGHT_RECORDER_VCD_FILE_HPP
+
+// Backend for VerilatedVcdC which keeps the most recent part of the trace in memory, and only writes it out on request
+// The owner calls VerilatedVcdC::openNext(false) every N ticks, which makes verilator close this "file"
+// and open a new one, starting with the header and a full dump of every signal
+// We keep the segment before the current one, so there are always at least N ticks of history available
+
+#include "verilated_vcd_c.h"
+#include <fstream>
+#include <optional>
+#include <string>
+
+class FlightRecorderVcdFile : public VerilatedVcdFile
+{
+public:
+    bool open(const std::string &name) override
+    {
+        filename = name;
+        current.clear();
+        return true;
+    }
+
+    void close() override
+    {
+        // A segment can be empty apart from the header, if we are closed just after a new segment was started
+        // Don't let that push out the previous segment
+        if(bodyStart(current) != current.size())
+        {
+            // Keep the old buffer around to reuse its storage
+            previous.swap(current);
+        }
+        current.clear();
+    }
+
+    ssize_t write(const char *bufp, ssize_t len) override
+    {
+        current.append(bufp, len);
+        return len;
+    }
+
+    // Write the recording to the file that verilator asked us to open
+    void writeOut(void) const
+    {
+        writeSegments(filename, previous, current);
+    }
+
+    // Hand the recording over to be kept after we are destroyed
+    // This lets a test harness write it out if a check fails after the model has gone out of scope
+    void retainAsLast(void)
+    {
+        last_recording = Recording{filename, std::move(previous), std::move(current)};
+    }
+
+    // Write out the recording of the last model that was destroyed without failing
+    static void writeLastRecording(void)
+    {
+        if(last_recording)
+        {
+            writeSegments(last_recording->filename, last_recording->previous, last_recording->current);
+            last_recording.reset();
+        }
+    }
+
+    // Forget the last recording, e.g. when a new test case starts, so a later failure can't write out an unrelated model's trace
+    static void discardLastRecording(void)
+    {
+        last_recording.reset();
+    }
+
+private:
+    std::string filename;
+    std::string previous;
+    std::string current;
+
+    struct Recording
+    {
+        std::string filename;
+        std::string previous;
+        std::string current;
+    };
+    static inline std::optional<Recording> last_recording;
+
+    static void writeSegments(const std::string &name, const std::string &first, const std::string &second)
+    {
+        std::ofstream os(name, std::ios::binary);
+        if(first.empty())
+        {
+            os << second;
+            return;
+        }
+
+        // Each segment is a complete VCD, so append the second without its header to get one continuous trace
+        os << first;
+        auto pos = bodyStart(second);
+        os.write(second.data() + pos, second.size() - pos);
+    }
+
+    // Index of the first timestamp after the header, or the size if there is no body
+    static size_t bodyStart(const std::string &segment)
+    {
+        static const std::string end_of_header = "$enddefinitions $end";
+        auto pos = segment.find(end_of_header);
+        if(pos == std::string::npos)
+        {
+            return segment.size();
+        }
+        pos = segment.find('#', pos);
+        return (pos == std::string::npos) ? segment.size() : pos;
+    }
+};
+
+#endif
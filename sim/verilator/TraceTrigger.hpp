@@ -0,0 +1,47 @@
+//  Copyright (C) 2021 Joshua Tyler
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//  See the file LICENSE_LGPL included with this distribution for more
+//  information.
+
+#ifndef TRACE_TRIGGER_HPP
+#define TRACE_TRIGGER_HPP
+
+// Conditions to start and stop waveform capture
+// Nothing is dumped until start returns true, and nothing more is dumped once stop returns true
+// Both are checked once per tick, after the model and peripherals have been evaluated
+
+#include <functional>
+#include "verilated.h"
+
+struct TraceTrigger
+{
+    std::function<bool(void)> start;
+    // If empty, trace until the end of the simulation
+    std::function<bool(void)> stop;
+};
+
+// Trace from start_time up to (but not including) stop_time
+// N.B. Pass in the model's time by reference, e.g. traceTimeWindow(uut.getTime(), 1000, 2000)
+inline TraceTrigger traceTimeWindow(const vluint64_t &time, vluint64_t start_time, vluint64_t stop_time)
+{
+    return TraceTrigger{
+        [&time, start_time]{return time >= start_time;},
+        [&time, stop_time]{return time >= stop_time;}
+    };
+}
+
+// Trace whilst the nth packet (counting from 1) is being received by a sink
+// Works with anything that has getNumPackets(), e.g. AXISSink or SimplePacketSink
+template <class SinkT> TraceTrigger traceNthPacket(const SinkT &sink, vluint64_t n)
+{
+    return TraceTrigger{
+        [&sink, n]{return sink.getNumPackets() + 1 >= n;},
+        [&sink, n]{return sink.getNumPackets() >= n;}
+    };
+}
+
+#endif
@@ -12,11 +12,23 @@
 
 #include "verilated.h"
 #include "verilated_vcd_c.h"
+#include "verilated_fst_c.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <string>
 #include <iostream>
+#include <memory>
+#include <exception>
+#include <vector>
 
+#include "AsyncVcdFile.hpp"
+#include "FlightRecorderVcdFile.hpp"
 #include "Peripheral.hpp"
+#include "TraceTrigger.hpp"
 #include "../other/ClockGen.hpp"
+#include "../other/Metrics.hpp"
 
 
 // Class that binds together a clock generator, and a Verilated model input
@@ -40,8 +52,69 @@ class VerilatedModelInterface
 {
 public:
     void addPeripheral(Peripheral *p) {peripherals.push_back(p);};
+    MetricsRegistry &getMetrics(void) {return metrics;};
 protected:
     std::vector<Peripheral *> peripherals;
+    MetricsRegistry metrics;
+};
+
+enum class TraceFormat {VCD, FST};
+
+// The trace formats a model was verilated with, i.e. TRACE and/or TRACE_FST in cmake
+// Verilator 5 models have one trace() for every format, so this can't be worked out from the model itself
+// Specialise this next to the model's #include for models verilated with TRACE_FST, e.g.
+// template <> struct VerilatedTraceFormats<Vfoo> {static constexpr bool vcd = false; static constexpr bool fst = true;};
+template <class MODEL> struct VerilatedTraceFormats
+{
+    static constexpr bool vcd = true;
+    static constexpr bool fst = false;
+};
+
+struct TraceScopeFilter
+{
+    // Full hierarchical name of a scope as it appears in the trace, e.g. "TOP.arp_engine_harness_with_mac.u_mac"
+    // Anything that starts with this (at a scope boundary) is included, so "TOP" is the whole model
+    std::string scope;
+    // Number of levels below the scope to include. 0 means only signals directly inside it
+    unsigned int depth = 0;
+};
+
+struct TraceConfig
+{
+    // N.B. The model must have been verilated with support for the chosen format (TRACE or TRACE_FST in cmake)
+    // FST is much smaller, and if the model is verilated with TRACE_THREADS compression happens on another thread
+    TraceFormat format = TraceFormat::VCD;
+    // Trace data is handed to a background thread to write out once this much has built up
+    size_t flush_bytes = 1 << 20;
+    // Or once this long has passed, so that traces can be looked at whilst the simulation runs
+    std::chrono::milliseconds flush_interval{500};
+    // If non-zero, only keep (at least) this many ticks of trace in memory, and only write it out if something fails
+    // Failing means the model is destroyed by an exception (including the watchdog),
+    // or the test harness calls FlightRecorderVcdFile::writeLastRecording() after the model is gone. VCD only
+    vluint64_t flight_recorder_ticks = 0;
+    // If non-zero, eval() throws VerilatedModelTimeout when the time reaches this
+    vluint64_t watchdog_ticks = 0;
+    // Number of levels of hierarchy below the top that verilator traces. Lower values make tracing cheaper
+    int depth = 99;
+    // If not empty, only trace signals within these scopes, e.g. {{"TOP.arp_engine_harness_with_mac.u_fifo", 1}}
+    // Passed to verilator (as $dumpvars would be), so signals that are left out cost nothing whilst tracing
+    // To leave signals out by name, or throughout a module, use tracing_off in a verilator configuration file when verilating
+    std::vector<TraceScopeFilter> scopes = {};
+};
+
+// Lets a test harness override whether models record a trace, without changing the tests
+struct TraceOverride
+{
+    enum class Mode {NONE, FORCE_OFF, FORCE_ON};
+    static inline Mode mode = Mode::NONE;
+    // When forcing traces on, this is prepended to trace file names, e.g. the name of the test case
+    // The full trace is always written, so the flight recorder is turned off
+    static inline std::string name_prefix;
+};
+
+struct VerilatedModelTimeout : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
 };
 
 // Take care of boilerplate for a verilated model
@@ -61,40 +134,181 @@ public:
 	}
 
 	VerilatedModel(std::string vcdname, bool recordVcd)
-	:time(0), tfp(NULL), finishCallback(neverBreak)
+	:VerilatedModel(vcdname, recordVcd, TraceConfig{})
 	{
-		uut = new MODEL;
+	}
+
+	VerilatedModel(std::string traceName, bool recordTrace, TraceConfig traceConfig)
+	:time(0), tfp(NULL), fst_tfp(NULL), finishCallback(neverBreak), start_time(std::chrono::steady_clock::now()),
+	 flight_recorder_ticks(traceConfig.flight_recorder_ticks), watchdog_ticks(traceConfig.watchdog_ticks),
+	 uncaught_exceptions(std::uncaught_exceptions())
+	{
+		metrics.setName(MetricsContext::nextModelName(std::filesystem::path(traceName).stem().string()));
+
+		switch(TraceOverride::mode)
+		{
+			case TraceOverride::Mode::NONE:
+				break;
+			case TraceOverride::Mode::FORCE_OFF:
+				recordTrace = false;
+				break;
+			case TraceOverride::Mode::FORCE_ON:
+			{
+				recordTrace = true;
+				std::filesystem::path path(traceName);
+				if (!TraceOverride::name_prefix.empty())
+				{
+					traceName = (path.parent_path() / (TraceOverride::name_prefix + "." + path.filename().string())).string();
+				}
+				traceConfig.flight_recorder_ticks = 0;
+				break;
+			}
+		}
+
+		// Before allocating anything, since the destructor won't run to free it if we throw
+		if (recordTrace)
+		{
+			checkTraceConfig(traceConfig);
+		}
 
-		if (recordVcd)
+		uut = new MODEL;
+		try
 		{
-			Verilated::traceEverOn(true);
-			tfp = new VerilatedVcdC;
-			uut->trace(tfp, 99);
+			if (recordTrace)
+			{
+				Verilated::traceEverOn(true);
+				std::cout << traceName << std::endl;
+				trace_name = traceName;
 
-			std::cout << vcdname << std::endl;
-			tfp->open(vcdname.c_str());
+				switch(traceConfig.format)
+				{
+					case TraceFormat::VCD:
+						openVcd(traceName, traceConfig);
+						break;
+					case TraceFormat::FST:
+						openFst(traceName, traceConfig);
+						break;
+				}
+			}
+
+			// Get initial state
+			uut->eval();
+		} catch(...) {
+			if constexpr (supportsVcd)
+			{
+				delete tfp;
+			}
+			if constexpr (supportsFst)
+			{
+				delete fst_tfp;
+			}
+			delete uut;
+			throw;
 		}
-		
-		// Get initial state
-		uut->eval();
 	}
 
 	~VerilatedModel()
 	{
-		delete uut;
+		if constexpr (supportsVcd)
+		{
+			// Save the recording before closing the trace, since closing it ends the current segment and drops the previous one
+			if (flight_recorder != NULL)
+			{
+				tfp->flush();
+				if(std::uncaught_exceptions() > uncaught_exceptions)
+				{
+					flight_recorder->writeOut();
+				} else {
+					flight_recorder->retainAsLast();
+				}
+			}
 
-		if (tfp != NULL)
+			// Closing the trace writes out everything that is still buffered
+			// This also happens when unwinding from an exception, so failing tests still get a complete trace
+			if (tfp != NULL)
+			{
+				tfp->close();
+				delete tfp;
+			}
+		}
+
+		if constexpr (supportsFst)
 		{
-			tfp->close();
-			delete tfp;
+			if (fst_tfp != NULL)
+			{
+				fst_tfp->close();
+				delete fst_tfp;
+			}
 		}
+
+		// If requested, append the metrics for this model to a JSON lines file so that CI can track them
+		// After closing the trace, so that its size on disk is known
+		const char *metrics_file = std::getenv("HDL_COMMON_METRICS");
+		if(metrics_file)
+		{
+			if (!trace_name.empty())
+			{
+				// Lets the cost of each trace format be compared. Nothing is recorded if the flight recorder didn't write a file
+				std::error_code ec;
+				auto size = std::filesystem::file_size(trace_name, ec);
+				if (!ec)
+				{
+					metrics.gauge("model.trace_bytes").set(size);
+				}
+			}
+			std::ofstream os(metrics_file, std::ios::app);
+			writeMetricsJson(os);
+			os << '\n';
+		}
+
+		delete uut;
 	};
 
 	void addClock(ClockBind *c) {clocks.push_back(c);};
+
+	// Only dump the trace inside a window, rather than for the whole simulation
+	void setTraceTrigger(TraceTrigger trigger)
+	{
+		trace_trigger = std::move(trigger);
+		trace_state = TraceState::WAITING;
+	}
 	void setFinishCallback(bool (*func)(void) ) {finishCallback = func;};
 
 	const vluint64_t & getTime(void) {return time;};
 
+	// Write out the flight recorder now, e.g. if a test detects a failure whilst the model is still in scope
+	void writeFlightRecording(void)
+	{
+		if constexpr (supportsVcd)
+		{
+			if (flight_recorder != NULL)
+			{
+				tfp->flush();
+				flight_recorder->writeOut();
+			}
+		}
+	}
+
+	void writeMetricsJson(std::ostream &os)
+	{
+		// Simulation speed is only known once we are asked for it
+		double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		metrics.gauge("model.ticks").set(time);
+		metrics.gauge("model.wall_time_s").set(wall_time);
+		metrics.gauge("model.ticks_per_s").set(wall_time > 0 ? (time / wall_time) : 0);
+		// Packet rate of every peripheral (and tdest or flow within it) that counts packets, e.g. AXISSink0.packets_per_s
+		for(const auto &[name, counter] : metrics.getCounters())
+		{
+			if(name.ends_with(".packets"))
+			{
+				metrics.gauge(name + "_per_s").set(wall_time > 0 ? (counter.get() / wall_time) : 0);
+			}
+		}
+		// Time spent on the simulation thread handing values to the trace, i.e. what tracing costs the simulation
+		metrics.gauge("model.trace_dump_s").set(std::chrono::duration<double>(trace_dump_time).count());
+		metrics.writeJson(os);
+	}
+
 	bool eval(void)
 	{
 		time++;
@@ -115,11 +329,39 @@ public:
 		}
 
 
+		updateTraceState();
+
 		//Add this to the dump
-		if (tfp != NULL)
+		// N.B. No flush here, trace_file takes care of getting data to disk in the background
+		if ((tfp != NULL || fst_tfp != NULL) && trace_state == TraceState::TRACING)
 		{
-		    tfp->dump(time);
-            tfp->flush();
+		    auto dump_start = std::chrono::steady_clock::now();
+		    if constexpr (supportsVcd)
+		    {
+		        if (tfp != NULL)
+		        {
+		            tfp->dump(time);
+
+		            // Start a new segment, so the recorder can discard the oldest one
+		            if (flight_recorder != NULL && (time % flight_recorder_ticks) == 0)
+		            {
+		                tfp->openNext(false);
+		            }
+		        }
+		    }
+		    if constexpr (supportsFst)
+		    {
+		        if (fst_tfp != NULL)
+		        {
+		            fst_tfp->dump(time);
+		        }
+		    }
+		    trace_dump_time += std::chrono::steady_clock::now() - dump_start;
+		}
+
+		if (watchdog_ticks && time >= watchdog_ticks)
+		{
+			throw VerilatedModelTimeout("Watchdog expired at time " + std::to_string(time));
 		}
 
 		return (!Verilated::gotFinish());
@@ -130,7 +372,114 @@ private:
 	std::vector<ClockBind *> clocks;
 	vluint64_t time;
 	VerilatedVcdC* tfp;
+	VerilatedFstC* fst_tfp;
+	std::unique_ptr<VerilatedVcdFile> trace_file;
+	FlightRecorderVcdFile* flight_recorder = NULL;
 	bool (*finishCallback)(void);
+	std::chrono::steady_clock::time_point start_time;
+	std::chrono::steady_clock::duration trace_dump_time{0};
+	// Empty if not tracing
+	std::string trace_name;
+	const vluint64_t flight_recorder_ticks;
+	const vluint64_t watchdog_ticks;
+	// So that we can tell if we are being destroyed because of an exception
+	const int uncaught_exceptions;
+
+	enum class TraceState {WAITING, TRACING, DONE};
+	TraceState trace_state = TraceState::TRACING;
+	TraceTrigger trace_trigger;
+
+	void updateTraceState(void)
+	{
+		switch(trace_state)
+		{
+			case TraceState::WAITING:
+				if (!trace_trigger.start())
+				{
+					break;
+				}
+				trace_state = TraceState::TRACING;
+				// The stop condition might already be true, so check it straight away
+				[[fallthrough]];
+			case TraceState::TRACING:
+				if (trace_trigger.stop && trace_trigger.stop())
+				{
+					trace_state = TraceState::DONE;
+				}
+				break;
+			case TraceState::DONE:
+				break;
+		}
+	}
+
+	// Verilator only links in the trace library for the format(s) the model was verilated with
+	// So only instantiate the code for each format if it is supported, otherwise we would get link errors
+	static constexpr bool supportsVcd = VerilatedTraceFormats<MODEL>::vcd;
+	static constexpr bool supportsFst = VerilatedTraceFormats<MODEL>::fst;
+
+	// Must be called before the model's signals are registered, i.e. before open
+	template <class TRACE> static void limitScopes(TRACE *trace, const TraceConfig &traceConfig)
+	{
+		for (const auto &scope : traceConfig.scopes)
+		{
+			// Verilator counts the signal's own name as a level
+			trace->dumpvars(scope.depth + 1, scope.scope);
+		}
+	}
+
+	static void checkTraceConfig(const TraceConfig &traceConfig)
+	{
+		switch(traceConfig.format)
+		{
+			case TraceFormat::VCD:
+				if (!supportsVcd)
+				{
+					throw std::logic_error("VCD tracing requested, but model was not verilated with VCD support");
+				}
+				break;
+			case TraceFormat::FST:
+				if (traceConfig.flight_recorder_ticks)
+				{
+					throw std::logic_error("The flight recorder only supports VCD");
+				}
+				if (!supportsFst)
+				{
+					throw std::logic_error("FST tracing requested, but model was not verilated with FST support");
+				}
+				break;
+		}
+	}
+
+	// The format has been checked by checkTraceConfig
+	void openVcd(const std::string &traceName, const TraceConfig &traceConfig)
+	{
+		if constexpr (supportsVcd)
+		{
+			if (traceConfig.flight_recorder_ticks)
+			{
+				auto recorder = std::make_unique<FlightRecorderVcdFile>();
+				flight_recorder = recorder.get();
+				trace_file = std::move(recorder);
+			} else {
+				trace_file = std::make_unique<AsyncVcdFile>(traceConfig.flush_bytes, traceConfig.flush_interval);
+			}
+			tfp = new VerilatedVcdC(trace_file.get());
+			limitScopes(tfp, traceConfig);
+			uut->trace(tfp, traceConfig.depth);
+			tfp->open(traceName.c_str());
+		}
+	}
+
+	void openFst(const std::string &traceName, const TraceConfig &traceConfig)
+	{
+		if constexpr (supportsFst)
+		{
+			fst_tfp = new VerilatedFstC;
+			limitScopes(fst_tfp, traceConfig);
+			uut->trace(fst_tfp, traceConfig.depth);
+			fst_tfp->open(traceName.c_str());
+		}
+	}
 };
 
 #endif
@@ -8,7 +8,11 @@
 //  information.
 
 #include <catch2/catch.hpp>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <thread>
 #include <verilated.h>
 #include "Vaxis_fifo.h"
 
@@ -17,7 +21,12 @@
 #include "../../../sim/other/ClockGen.hpp"
 #include "../../../sim/axis/AXISSink.hpp"
 #include "../../../sim/axis/AXISSource.hpp"
+#include "../../../sim/axis/AXISMonitor.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
+#include "../../../sim/other/GeneratorPacketSource.hpp"
+#include "../../../sim/other/PacketCorpus.hpp"
+#include "../../../sim/other/QueuePacketSourceSink.hpp"
+#include "../../../sim/other/ScoreboardSink.hpp"
 
 std::vector<std::vector<vluint8_t>> testFifo(std::vector<std::vector<vluint8_t>> inData)
 {
@@ -51,3 +60,199 @@ TEST_CASE("Test data comes out of FIFO", "[axis_fifo]")
 	std::vector<std::vector<vluint8_t>> testData = {{0x0,0x1,0x2,0x3}};
 	REQUIRE(testFifo(testData) == testData);
 }
+
+TEST_CASE("Test flight recorder keeps at least the last N ticks when a test fails", "[axis_fifo]")
+{
+    constexpr vluint64_t recorder_ticks = 100;
+    const std::string trace_name = "fifo_flight_recorder.vcd";
+    std::filesystem::remove(trace_name);
+
+    // The watchdog fails the test a few ticks after the recorder starts a new segment
+    REQUIRE_THROWS_AS([&]() {
+        VerilatedModel<Vaxis_fifo> uut(trace_name, true, TraceConfig{.flight_recorder_ticks = recorder_ticks, .watchdog_ticks = 10 * recorder_ticks + 5});
+
+        ClockGen clk(uut.getTime(), 1e-9, 100e6);
+        ClockBind clkDriver(clk,uut.uut->clk);
+        uut.addClock(&clkDriver);
+
+        while(uut.eval())
+        {
+        }
+    }(), VerilatedModelTimeout);
+
+    // Forcing traces on or off (e.g. --retrace-failures) replaces the flight recorder, so there is nothing to check
+    if(TraceOverride::mode != TraceOverride::Mode::NONE)
+    {
+        return;
+    }
+
+    std::ifstream vcd(trace_name);
+    REQUIRE(vcd);
+    std::optional<vluint64_t> first;
+    vluint64_t last = 0;
+    std::string line;
+    while(std::getline(vcd, line))
+    {
+        if(!line.empty() && line[0] == '#')
+        {
+            last = std::stoull(line.substr(1));
+            first = first.value_or(last);
+        }
+    }
+    REQUIRE(first);
+    REQUIRE(last - *first >= recorder_ticks);
+}
+
+TEST_CASE("Test a long stream of packets comes out of FIFO", "[axis_fifo]")
+{
+    constexpr size_t num_packets = 2000;
+
+    // Packets are generated as they're needed, and generated again to check them as they arrive, so nothing is stored
+    auto generator = PacketGenerators::randomContent(1, 37);
+    GeneratorPacketSource<uint8_t> inAxisSource(generator, num_packets);
+    GeneratorPacketSource<uint8_t> expected(generator, num_packets);
+    ScoreboardSink<uint8_t> scoreboard(&expected, ScoreboardConfig{.fail_fast = true});
+
+    {
+        VerilatedModel<Vaxis_fifo> uut("fifo_long.vcd",false);
+
+        ClockGen clk(uut.getTime(), 1e-9, 100e6);
+        AXISSink<vluint8_t> outAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep,  .tdata = &uut.uut->axis_o_tdata}, &scoreboard);
+
+        AXISSource<vluint8_t> inAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_i_tready, .tvalid = &uut.uut->axis_i_tvalid, .tlast = &uut.uut->axis_i_tlast, .tkeep = &uut.uut->axis_i_tkeep, .tdata = &uut.uut->axis_i_tdata},
+                                     &inAxisSource);
+
+        // Watch the output, in windows of 1000 cycles
+        AXISMonitor<vluint8_t> monitor(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep,  .tdata = &uut.uut->axis_o_tdata},
+                                       AXISMonitorConfig{.window_cycles = 1000});
+
+        ResetGen resetGen(&uut, &clk, &uut.uut->sresetn, false);
+
+        ClockBind clkDriver(clk,uut.uut->clk);
+        uut.addClock(&clkDriver);
+
+        while(uut.eval() && scoreboard.getNumReceived() != num_packets && uut.getTime() < 10000000)
+        {
+        }
+
+        auto totals = monitor.getTotals();
+        REQUIRE(totals.packets == num_packets);
+        REQUIRE(totals.beats == totals.bytes);
+        REQUIRE(totals.beats + totals.stall_cycles + totals.bubble_cycles <= totals.cycles);
+        REQUIRE(monitor.getWindows().size() == totals.cycles / 1000);
+        std::cout << "FIFO output utilisation: " << totals.utilisation() << std::endl;
+    }
+
+    scoreboard.finish();
+    INFO(scoreboard.report());
+    REQUIRE(scoreboard.passed());
+    REQUIRE(scoreboard.getNumMatched() == num_packets);
+}
+
+TEST_CASE("Test FIFO fed and checked from other threads", "[axis_fifo]")
+{
+    constexpr size_t num_packets = 2000;
+    auto generator = PacketGenerators::randomContent(1, 37);
+
+    // The simulation waits for the generator, so it sees the same stimulus however the threads are scheduled
+    PacketQueue<uint8_t> inQueue(PacketQueueConfig{.capacity = 64, .empty_policy = PacketQueuePolicy::BLOCK});
+    PacketQueue<uint8_t> outQueue(PacketQueueConfig{.capacity = 64, .empty_policy = PacketQueuePolicy::BLOCK});
+
+    // Both threads stop once their queue is closed, so neither can hang if the simulation stops early
+    std::thread producer([&]() {
+        GeneratorPacketSource<uint8_t> stimulus(generator, num_packets);
+        while(auto packet = stimulus.receivePooled(inQueue.getPool()))
+        {
+            if(!inQueue.push(std::move(*packet)))
+            {
+                break;
+            }
+        }
+        inQueue.close();
+    });
+
+    GeneratorPacketSource<uint8_t> expected(generator, num_packets);
+    ScoreboardSink<uint8_t> scoreboard(&expected);
+    std::thread checker([&]() {
+        while(auto packet = outQueue.pop())
+        {
+            scoreboard.sendPooled(std::move(*packet));
+        }
+    });
+
+    {
+        VerilatedModel<Vaxis_fifo> uut("fifo_threads.vcd",false);
+
+        ClockGen clk(uut.getTime(), 1e-9, 100e6);
+        QueuePacketSink<uint8_t> outAxisSink(&outQueue);
+        AXISSink<vluint8_t> outAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep,  .tdata = &uut.uut->axis_o_tdata}, &outAxisSink);
+
+        QueuePacketSource<uint8_t> inAxisSource(&inQueue);
+        AXISSource<vluint8_t> inAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_i_tready, .tvalid = &uut.uut->axis_i_tvalid, .tlast = &uut.uut->axis_i_tlast, .tkeep = &uut.uut->axis_i_tkeep, .tdata = &uut.uut->axis_i_tdata},
+                                     &inAxisSource);
+
+        ResetGen resetGen(&uut, &clk, &uut.uut->sresetn, false);
+
+        ClockBind clkDriver(clk,uut.uut->clk);
+        uut.addClock(&clkDriver);
+
+        while(uut.eval() && outAxis.getNumPackets() != num_packets && uut.getTime() < 10000000)
+        {
+        }
+    }
+
+    outQueue.close();
+    inQueue.close();
+    producer.join();
+    checker.join();
+
+    scoreboard.finish();
+    INFO(scoreboard.report());
+    REQUIRE(scoreboard.getNumReceived() == num_packets);
+    REQUIRE(scoreboard.passed());
+    REQUIRE(scoreboard.getNumMatched() == num_packets);
+    REQUIRE(inQueue.getStats().popped == num_packets);
+}
+
+TEST_CASE("Test FIFO with stimulus from a packet corpus", "[axis_fifo]")
+{
+    constexpr size_t num_packets = 500;
+    {
+        PacketCorpusWriter writer("fifo_corpus.bin");
+        GeneratorPacketSource<uint8_t> stimulus(PacketGenerators::randomContent(1, 64, 3), num_packets);
+        while(auto packet = stimulus.receive())
+        {
+            writer.add(*packet);
+        }
+    }
+
+    // The same corpus is both the stimulus and the expected output, each packet being read straight from the mapping
+    PacketCorpus corpus("fifo_corpus.bin");
+    REQUIRE(corpus.getNumPackets() == num_packets);
+    PacketCorpusSource<uint8_t> inAxisSource(&corpus);
+    PacketCorpusSource<uint8_t> expected(&corpus);
+    ScoreboardSink<uint8_t> scoreboard(&expected, ScoreboardConfig{.fail_fast = true});
+
+    {
+        VerilatedModel<Vaxis_fifo> uut("fifo_corpus.vcd",false);
+
+        ClockGen clk(uut.getTime(), 1e-9, 100e6);
+        AXISSink<vluint8_t> outAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep,  .tdata = &uut.uut->axis_o_tdata}, &scoreboard);
+
+        AXISSource<vluint8_t> inAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_i_tready, .tvalid = &uut.uut->axis_i_tvalid, .tlast = &uut.uut->axis_i_tlast, .tkeep = &uut.uut->axis_i_tkeep, .tdata = &uut.uut->axis_i_tdata},
+                                     &inAxisSource);
+
+        ResetGen resetGen(&uut, &clk, &uut.uut->sresetn, false);
+
+        ClockBind clkDriver(clk,uut.uut->clk);
+        uut.addClock(&clkDriver);
+
+        while(uut.eval() && scoreboard.getNumReceived() != num_packets && uut.getTime() < 10000000)
+        {
+        }
+    }
+
+    scoreboard.finish();
+    INFO(scoreboard.report());
+    REQUIRE(scoreboard.passed());
+}
@@ -17,6 +17,7 @@
 #include "../../../sim/other/ClockGen.hpp"
 #include "../../../sim/axis/AXISSink.hpp"
 #include "../../../sim/axis/AXISSource.hpp"
+#include "../../../sim/axis/LatencyTracker.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
 
 std::vector<std::vector<vluint8_t>> testPacketFifo(std::vector<std::vector<vluint8_t>> inData)
@@ -51,3 +52,41 @@ TEST_CASE("Test data comes out of packet FIFO", "[axis_packet_fifo]")
 	std::vector<std::vector<vluint8_t>> testData = {{0x0,0x1,0x2,0x3}};
 	REQUIRE(testPacketFifo(testData) == testData);
 }
+
+TEST_CASE("Test packet FIFO holds packets until they are complete", "[axis_packet_fifo]")
+{
+	std::vector<std::vector<vluint8_t>> testData;
+	for(size_t length : {1, 8, 16, 30})
+	{
+		testData.push_back(std::vector<vluint8_t>(length, length));
+	}
+
+	VerilatedModel<Vaxis_packet_fifo> uut("packet_fifo_latency.vcd", false);
+
+	ClockGen clk(uut.getTime(), 1e-9, 100e6);
+	LatencyTracker latency(&uut, &clk);
+
+    SimplePacketSink<uint8_t> outAxisSink;
+	AXISSink<vluint8_t> outAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep,  .tdata = &uut.uut->axis_o_tdata}, &outAxisSink, {}, AXISSinkConfig{.latency = &latency});
+
+    SimplePacketSource<uint8_t> inAxisSource(testData);
+	AXISSource<vluint8_t> inAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<vluint8_t>{.tready = &uut.uut->axis_i_tready, .tvalid = &uut.uut->axis_i_tvalid, .tlast = &uut.uut->axis_i_tlast, .tkeep = &uut.uut->axis_i_tkeep, .tdata = &uut.uut->axis_i_tdata},
+                                 &inAxisSource, {}, AXISSourceConfig{.latency = &latency});
+
+	ResetGen resetGen(&uut, &clk, &uut.uut->sresetn, false);
+
+	ClockBind clkDriver(clk,uut.uut->clk);
+	uut.addClock(&clkDriver);
+
+	while(uut.eval() && uut.getTime() < 10000 && outAxisSink.getNumPackets() != testData.size())
+	{
+	}
+
+	REQUIRE(outAxisSink.getData() == testData);
+	REQUIRE(latency.getNumReceived() == testData.size());
+	REQUIRE(latency.getNumUnmatched() == 0);
+	std::cout << "Packet FIFO latency (cycles) min: " << latency.getMin() << " p50: " << latency.getPercentile(0.5) << " p99: " << latency.getPercentile(0.99) << " max: " << latency.getMax() << std::endl;
+	// Store and forward, so the output can't finish until the whole packet has gone in, and then has to come out
+	REQUIRE(latency.getMin() >= 1);
+	REQUIRE(latency.getMax() >= 2 * 30 - 1);
+}
@@ -13,6 +13,8 @@
 #include "Vaxis_width_converter_1i_1o.h"
 #include "Vaxis_width_converter_1i_2o.h"
 #include "Vaxis_width_converter_2i_1o.h"
+#include "Vaxis_width_converter_16i_64o.h"
+#include "Vaxis_width_converter_64i_16o.h"
 
 #include "../../../sim/verilator/VerilatedModel.hpp"
 #include "../../../sim/other/ResetGen.hpp"
@@ -21,17 +23,20 @@
 #include "../../../sim/axis/AXISSource.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
 
-template <class model_t, class data_in_t, class data_out_t> auto testWidthConverter(std::vector<std::vector<uint8_t>> inData, std::string vcdName="foo.vcd", bool recordVcd=false)
+template <class model_t, class data_in_t, class data_out_t> auto testWidthConverter(std::vector<std::vector<uint8_t>> inData, std::string vcdName="foo.vcd", bool recordVcd=false, AXISSourceConfig sourceConfig=AXISSourceConfig{}, AXISSinkConfig sinkConfig=AXISSinkConfig{})
 {
+	typedef decltype(model_t::axis_i_tkeep) keep_in_t;
+	typedef decltype(model_t::axis_o_tkeep) keep_out_t;
+
 	VerilatedModel<model_t> uut(vcdName, recordVcd);
 
 	ClockGen clk(uut.getTime(), 1e-9, 100e6);
 
     SimplePacketSource<uint8_t> inAxisSource(inData);
-	AXISSource<data_in_t, vluint8_t> inAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<data_in_t, vluint8_t>{.tready = &uut.uut->axis_i_tready, .tvalid = &uut.uut->axis_i_tvalid, .tlast = &uut.uut->axis_i_tlast, .tkeep = &uut.uut->axis_i_tkeep, .tdata = &uut.uut->axis_i_tdata}, &inAxisSource);
+	AXISSource<data_in_t, keep_in_t> inAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<data_in_t, keep_in_t>{.tready = &uut.uut->axis_i_tready, .tvalid = &uut.uut->axis_i_tvalid, .tlast = &uut.uut->axis_i_tlast, .tkeep = &uut.uut->axis_i_tkeep, .tdata = &uut.uut->axis_i_tdata}, &inAxisSource, {}, sourceConfig);
 
     SimplePacketSink<uint8_t> outAxisSink;
-	AXISSink<data_out_t, vluint8_t> outAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<data_out_t, vluint8_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep, .tdata = &uut.uut->axis_o_tdata}, &outAxisSink);
+	AXISSink<data_out_t, keep_out_t> outAxis(&uut, &clk, &uut.uut->sresetn, AxisSignals<data_out_t, keep_out_t>{.tready = &uut.uut->axis_o_tready, .tvalid = &uut.uut->axis_o_tvalid, .tlast = &uut.uut->axis_o_tlast, .tkeep = &uut.uut->axis_o_tkeep, .tdata = &uut.uut->axis_o_tdata}, &outAxisSink, {}, sinkConfig);
 
 
 	ResetGen resetGen(&uut, &clk, &uut.uut->sresetn, false);
@@ -59,6 +64,7 @@ template <class model_t, class data_in_t, class data_out_t> auto testWidthConver
             break;
         }
 	}
+	std::cout << "Beats per cycle in: " << inAxis.getBeatsPerCycle() << " out: " << outAxis.getBeatsPerCycle() << std::endl;
     return outAxisSink.getData();
 }
 
@@ -90,3 +96,54 @@ TEST_CASE("width_converter: Test converting narrow to wide, but assering tkeep e
 	// No need to pad since tkeep is supported
 	REQUIRE(data == result);
 }
+
+static std::vector<std::vector<vluint8_t>> incrementingPackets(std::vector<size_t> lengths)
+{
+    std::vector<std::vector<vluint8_t>> ret;
+    for(auto length : lengths)
+    {
+        ret.push_back({});
+        for(size_t i=0; i < length; i++)
+        {
+            ret.back().push_back(i + length);
+        }
+    }
+    return ret;
+}
+
+// Wide buses are VlWide<N> in verilator, with N 32 bit words
+TEST_CASE("width_converter: Test converting 16 bytes to 64 bytes", "[axis_width_converter]")
+{
+    const auto data = incrementingPackets({1, 16, 63, 64, 65, 200});
+    auto result = testWidthConverter<Vaxis_width_converter_16i_64o, VlWide<4>, VlWide<16>>(data);
+    REQUIRE(data == result);
+}
+
+TEST_CASE("width_converter: Test converting 64 bytes to 16 bytes", "[axis_width_converter]")
+{
+    const auto data = incrementingPackets({1, 16, 63, 64, 65, 200});
+    auto result = testWidthConverter<Vaxis_width_converter_64i_16o, VlWide<16>, VlWide<4>>(data);
+    REQUIRE(data == result);
+}
+
+// The beats per cycle at each end of the converter are printed, to show how throughput holds up
+TEST_CASE("width_converter: Test converting 16 bytes to 64 bytes under backpressure", "[axis_width_converter]")
+{
+    const auto data = incrementingPackets({1, 16, 63, 64, 65, 200, 17, 128});
+
+    SECTION("Bursty sink")
+    {
+        auto result = testWidthConverter<Vaxis_width_converter_16i_64o, VlWide<4>, VlWide<16>>(data, "foo.vcd", false, AXISSourceConfig{}, AXISSinkConfig{.flow_control = AxisFlowControl::markov(0.3, 0.2)});
+        REQUIRE(data == result);
+    }
+    SECTION("Throttled source")
+    {
+        auto result = testWidthConverter<Vaxis_width_converter_16i_64o, VlWide<4>, VlWide<16>>(data, "foo.vcd", false, AXISSourceConfig{.flow_control = AxisFlowControl::dutyCycle(0.5)});
+        REQUIRE(data == result);
+    }
+    SECTION("Rate limited source, periodically stalled sink")
+    {
+        auto result = testWidthConverter<Vaxis_width_converter_16i_64o, VlWide<4>, VlWide<16>>(data, "foo.vcd", false, AXISSourceConfig{.flow_control = AxisFlowControl::tokenBucket(0.75, 4)}, AXISSinkConfig{.flow_control = AxisFlowControl::pattern({true, false, false})});
+        REQUIRE(data == result);
+    }
+}
@@ -22,10 +22,17 @@
 #include "../../../sim/network/GMIISink.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
 #include "../../../sim/network/TunTap.hpp"
+#include "../../../sim/network/Pcap.hpp"
+#include "../../../sim/other/GeneratorPacketSource.hpp"
+#include "../../../sim/other/PacedPacketSource.hpp"
+
+// Verilated with TRACE_FST (see CMakeLists.txt)
+template <> struct VerilatedTraceFormats<Varp_engine_harness> {static constexpr bool vcd = false; static constexpr bool fst = true;};
+template <> struct VerilatedTraceFormats<Varp_engine_harness_with_mac> {static constexpr bool vcd = false; static constexpr bool fst = true;};
 
 TEST_CASE("arp_engine: Test ARP engine responds to ARP requests", "[arp_engine]")
 {
-    VerilatedModel<Varp_engine_harness> uut("arp_engine.vcd", true);
+    VerilatedModel<Varp_engine_harness> uut("arp_engine.fst", true, TraceConfig{.format = TraceFormat::FST});
 
     ClockGen clk(uut.getTime(), 1e-9, 100e6);
     ResetGen resetGen(&uut, &clk, &uut.uut->sresetn, false);
@@ -87,7 +94,7 @@ TEST_CASE("arp_engine: Test ARP engine responds to ARP requests", "[arp_engine]"
 
 TEST_CASE("arp_engine: Test ARP engine responds to ARP requests (with ethernet MAC in the loop too", "[arp_engine]")
 {
-    VerilatedModel<Varp_engine_harness_with_mac> uut("arp_engine_with_mac.vcd", true);
+    VerilatedModel<Varp_engine_harness_with_mac> uut("arp_engine_with_mac.fst", true, TraceConfig{.format = TraceFormat::FST});
 
     ClockGen clketh(uut.getTime(), 1e-9, 125e6);
     ClockGen clkuser(uut.getTime(), 1e-9, 50e6);
@@ -135,4 +142,130 @@ TEST_CASE("arp_engine: Test ARP engine responds to ARP requests (with ethernet M
     int ret = WEXITSTATUS(pclose(arping_file));
 
     REQUIRE(ret == 0);
-}
\ No newline at end of file
+}
+
+// From 10.0.0.100, asking who has 10.0.0.110 (the harness)
+static const std::vector<uint8_t> arp_request =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x06, // Ethernet
+    0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,                                     // Ethernet/IPv4 request
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 10, 0, 0, 100,                                  // Sender
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 10, 0, 0, 110                                   // Target
+};
+
+static void requireArpReply(std::span<const uint8_t> reply)
+{
+    REQUIRE(reply.size() >= 42);
+    std::vector<uint8_t> expected_dst = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    std::vector<uint8_t> expected_ethertype = {0x08, 0x06};
+    std::vector<uint8_t> expected_opcode = {0x00, 0x02};
+    std::vector<uint8_t> expected_sender_ip = {10, 0, 0, 110};
+    REQUIRE(std::vector<uint8_t>(reply.begin(), reply.begin() + 6) == expected_dst);
+    REQUIRE(std::vector<uint8_t>(reply.begin() + 12, reply.begin() + 14) == expected_ethertype);
+    REQUIRE(std::vector<uint8_t>(reply.begin() + 20, reply.begin() + 22) == expected_opcode);
+    REQUIRE(std::vector<uint8_t>(reply.begin() + 28, reply.begin() + 32) == expected_sender_ip);
+}
+
+TEST_CASE("arp_engine: Test ARP engine replies to a captured ARP request (with ethernet MAC in the loop)", "[arp_engine]")
+{
+    // Make a capture to replay. Real captures have other traffic in them too, which should be ignored
+    // It also gives the harness time to come out of reset before the request arrives
+    {
+        vluint64_t capture_time = 0;
+        PcapPacketSink capture("arp_request.pcapng", capture_time, 1e-9);
+
+        std::vector<uint8_t> other_traffic = {0x02, 0x00, 0x00, 0x00, 0x00, 0x09, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x88, 0xB5};
+        for(int i=0; i < 10; i++)
+        {
+            capture.send(other_traffic);
+            capture_time += 1000;
+        }
+
+        std::vector<uint8_t> request = arp_request;
+        capture.send(request);
+    }
+
+    {
+        VerilatedModel<Varp_engine_harness_with_mac> uut("arp_engine_pcap.fst", false, TraceConfig{.format = TraceFormat::FST});
+
+        ClockGen clketh(uut.getTime(), 1e-9, 125e6);
+        ClockGen clkuser(uut.getTime(), 1e-9, 50e6);
+
+        PcapPacketSource replay("arp_request.pcapng");
+        GMIISource src(&uut, &clketh, &uut.uut->eth_rxd, &uut.uut->eth_rxdv, &uut.uut->eth_rxer, &replay);
+
+        // The MAC sends the FCS, so record that it is there for wireshark
+        PcapPacketSink capture("arp_reply.pcapng", uut.getTime(), 1e-9, PcapWriterConfig{.has_fcs = true});
+        GMIISink sink(&uut, &clketh, &uut.uut->eth_txd, &uut.uut->eth_txen, &uut.uut->eth_txer, &capture);
+
+        ClockBind clkDriverUser(clkuser,uut.uut->clk);
+        ClockBind clkDriverEth(clketh, uut.uut->eth_rxclk);
+        uut.addClock(&clkDriverUser);
+        uut.addClock(&clkDriverEth);
+
+        while(uut.eval() && capture.getNumPackets() == 0 && uut.getTime() < 100000)
+        {
+        }
+        REQUIRE(replay.getNumPackets() == 11);
+    }
+
+    // The FCS is removed on reading, as the capture says it is there
+    PcapPacketSource reply_capture("arp_reply.pcapng");
+    auto reply = reply_capture.receive();
+    REQUIRE(reply);
+    requireArpReply(*reply);
+}
+
+TEST_CASE("arp_engine: Test ARP engine replies to an ARP request amongst line rate IMIX traffic (with ethernet MAC in the loop)", "[arp_engine]")
+{
+    constexpr uint64_t num_packets = 100;
+    constexpr uint64_t arp_index = 50;
+
+    // Background traffic for someone else, with the ARP request in the middle
+    auto background = PacketGenerators::imix(1);
+    GeneratorPacketSource<uint8_t> traffic([&](uint64_t index, std::vector<uint8_t> &packet)
+    {
+        if(index == arp_index)
+        {
+            packet = arp_request;
+            return;
+        }
+        background(index, packet);
+        std::vector<uint8_t> header = {0x02, 0x00, 0x00, 0x00, 0x00, 0x09, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x88, 0xB5};
+        std::copy(header.begin(), header.end(), packet.begin());
+    }, num_packets);
+
+    VerilatedModel<Varp_engine_harness_with_mac> uut("arp_engine_imix.fst", false, TraceConfig{.format = TraceFormat::FST});
+
+    ClockGen clketh(uut.getTime(), 1e-9, 125e6);
+    ClockGen clkuser(uut.getTime(), 1e-9, 50e6);
+
+    // 100% of gigabit line rate, i.e. back to back with the minimum gap
+    PacedPacketSource paced(&uut, &clketh, &traffic, PacingConfig{.mode = PacingConfig::Mode::BIT_RATE, .rate = 1000, .wire_bytes = PacingConfig::ethernetWireBytes});
+    GMIISource src(&uut, &clketh, &uut.uut->eth_rxd, &uut.uut->eth_rxdv, &uut.uut->eth_rxer, &paced);
+
+    SimplePacketSink<uint8_t> reply_sink;
+    GMIISink sink(&uut, &clketh, &uut.uut->eth_txd, &uut.uut->eth_txen, &uut.uut->eth_txer, &reply_sink);
+
+    ClockBind clkDriverUser(clkuser,uut.uut->clk);
+    ClockBind clkDriverEth(clketh, uut.uut->eth_rxclk);
+    uut.addClock(&clkDriverUser);
+    uut.addClock(&clkDriverEth);
+
+    while(uut.eval() && paced.getNumPackets() != num_packets && uut.getTime() < 10000000)
+    {
+    }
+    // Let the reply get out
+    vluint64_t end_time = uut.getTime() + 20000;
+    while(uut.eval() && uut.getTime() < end_time)
+    {
+    }
+
+    std::cout << "Requested " << paced.getRequestedMbps() << " Mb/s, achieved " << paced.getAchievedMbps() << " Mb/s" << std::endl;
+    REQUIRE(paced.getNumPackets() == num_packets);
+    REQUIRE(paced.getNumLate() == 0);
+    REQUIRE(paced.getAchievedMbps() == Approx(1000).epsilon(0.01));
+
+    REQUIRE(reply_sink.getNumPackets() == 1);
+    requireArpReply(reply_sink.getData().front());
+}
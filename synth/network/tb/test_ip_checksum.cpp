@@ -18,77 +18,7 @@
 #include "../../../sim/axis/AXISSink.hpp"
 #include "../../../sim/axis/AXISSource.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
-
-//#define __LITTLE_ENDIAN
-// Begin copied and pasted from linux/lib/checksum.c
-static inline unsigned short from32to16(unsigned int x)
-{
-	/* add up 16-bit and 16-bit for 16+c bit */
-	x = (x & 0xffff) + (x >> 16);
-	/* add up carry.. */
-	x = (x & 0xffff) + (x >> 16);
-	return x;
-}
-
-static unsigned int do_csum(const unsigned char *buff, int len)
-{
-	int odd;
-	unsigned int result = 0;
-
-	if (len <= 0)
-		goto out;
-	odd = 1 & (unsigned long) buff;
-	if (odd) {
-#ifdef __LITTLE_ENDIAN
-		result += (*buff << 8);
-#else
-		result = *buff;
-#endif
-		len--;
-		buff++;
-	}
-	if (len >= 2) {
-		if (2 & (unsigned long) buff) {
-			result += *(unsigned short *) buff;
-			len -= 2;
-			buff += 2;
-		}
-		if (len >= 4) {
-			const unsigned char *end = buff + ((unsigned)len & ~3);
-			unsigned int carry = 0;
-			do {
-				unsigned int w = *(unsigned int *) buff;
-				buff += 4;
-				result += carry;
-				result += w;
-				carry = (w > result);
-			} while (buff < end);
-			result += carry;
-			result = (result & 0xffff) + (result >> 16);
-		}
-		if (len & 2) {
-			result += *(unsigned short *) buff;
-			buff += 2;
-		}
-	}
-	if (len & 1)
-#ifdef __LITTLE_ENDIAN
-		result += *buff;
-#else
-		result += (*buff << 8);
-#endif
-	result = from32to16(result);
-	if (odd)
-		result = ((result >> 8) & 0xff) | ((result & 0xff) << 8);
-out:
-	return result;
-}
-// This is adapted slightly to not use kernel types
-static uint16_t ip_compute_csum(const void *buff, int len)
-{
-	return (uint16_t)~do_csum((const unsigned char *)buff, len);
-}
-// End copied and pasted from linux/lib/checksum.c
+#include "../../../sim/network/InternetChecksum.hpp"
 
 template <class Verilated> auto testIpChecksum(std::vector<std::vector<uint8_t>> inData, bool record_vcd=false)
 {
@@ -141,14 +71,17 @@ template <class T> std::vector<std::vector<uint8_t>> convert_to_byte_vector_vect
 template <class Verilated> void testChecksum(std::vector<std::vector<vluint16_t>> in, bool record=false)
 {
 	// UDP Checksum is same algorithm as IP checksum
-	std::vector<std::vector<vluint16_t>> outData;
-	for(size_t i=0; i < in.size(); i++)
+	auto inData = convert_to_byte_vector_vector(in);
+	std::vector<std::vector<uint8_t>> outData;
+	for(const auto &packet : inData)
 	{
-		outData.push_back({ip_compute_csum((unsigned char *)in[i].data(),in[i].size()*sizeof(in[i][0]))});
+		// The checksum comes out in network order
+		uint16_t csum = InternetChecksum::compute(packet);
+		outData.push_back({static_cast<uint8_t>(csum >> 8), static_cast<uint8_t>(csum & 0xFF)});
 	}
 
-	auto result = testIpChecksum<Verilated>(convert_to_byte_vector_vector(in), record);
-	REQUIRE( result == convert_to_byte_vector_vector(outData));
+	auto result = testIpChecksum<Verilated>(inData, record);
+	REQUIRE( result == outData);
 }
 
 TEMPLATE_TEST_CASE("ip_checksum: Test correct values", "[ip_checksum]", IP_CHECKSUM_VERILATED_CLASSES)
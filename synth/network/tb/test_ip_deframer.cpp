@@ -18,6 +18,7 @@
 #include "../../../sim/axis/AXISSink.hpp"
 #include "../../../sim/axis/AXISSource.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
+#include "../../../sim/network/PacketBuilder.hpp"
 
 namespace {
     struct ret_data {
@@ -153,4 +154,55 @@ namespace {
         expected_data.push_back(0);
         REQUIRE(result.payload == expected_data);
     }
-}
\ No newline at end of file
+
+    TEST_CASE("Test packet builder matches the captured UDP packet", "[ip_deframer]")
+    {
+        std::vector<vluint8_t> captured =
+                {0x45, 0x00, 0x00, 0x21, 0xe9, 0x37, 0x40, 0x00, 0x40, 0x11, 0xcf, 0xfb,
+                 0xC0, 0xA8, 0x00, 0x25, 0xC0, 0xA8, 0x00, 0x23,
+                 0xDC, 0x9B, 0x08, 0x43, 0x00, 0x0d, 0x81, 0xb7, 0x48, 0x65, 0x6c, 0x6c, 0x6f};
+
+        const uint8_t hello[] = {'H', 'e', 'l', 'l', 'o'};
+        std::vector<vluint8_t> packet;
+        PacketBuilder(packet)
+                .ipv4({.src = ipv4Address(192, 168, 0, 37), .dst = ipv4Address(192, 168, 0, 35), .identification = 0xe937})
+                .udp({.src_port = 0xDC9B, .dst_port = 2115})
+                .payload(hello)
+                .finish();
+
+        // The UDP checksum in the capture doesn't verify (it was probably left to offload), so check ours against the pseudo header instead
+        const uint8_t pseudo_header[] = {0xC0, 0xA8, 0x00, 0x25, 0xC0, 0xA8, 0x00, 0x23, 0x00, 0x11, 0x00, 0x0d};
+        uint64_t sum = InternetChecksum::add(0, pseudo_header);
+        sum = InternetChecksum::add(sum, std::span<const uint8_t>(packet).subspan(20));
+        REQUIRE(InternetChecksum::finish(sum) == 0);
+
+        REQUIRE(packet.size() == captured.size());
+        packet[26] = captured[26];
+        packet[27] = captured[27];
+        REQUIRE(packet == captured);
+    }
+
+    TEST_CASE("Test deframer with built UDP and TCP packets, with and without options", "[ip_deframer]")
+    {
+        // Keep the packets short enough to get through in the time testdeframer allows
+        // The deframer doesn't pass on empty payloads, so always have at least one byte
+        RandomTrafficConfig config{.ethernet = false, .src_ip_count = 100, .dst_ip_count = 100,
+                                   .min_payload = 1, .max_payload = 200,
+                                   .ip_options_fraction = 0.5, .tcp_options_fraction = 0.5};
+        auto generator = PacketGenerators::randomTraffic(config, 49);
+
+        std::vector<vluint8_t> packet;
+        for(uint64_t i=0; i < 20; i++)
+        {
+            generator(i, packet);
+            size_t ihl = (packet[0] & 0xF) * 4;
+
+            auto result = testdeframer(packet);
+            REQUIRE(result.protocol == packet[9]);
+            REQUIRE(result.src_ip == (uint32_t(packet[12]) << 24 | uint32_t(packet[13]) << 16 | uint32_t(packet[14]) << 8 | packet[15]));
+            REQUIRE(result.dest_ip == (uint32_t(packet[16]) << 24 | uint32_t(packet[17]) << 16 | uint32_t(packet[18]) << 8 | packet[19]));
+            REQUIRE(result.payload_length == packet.size() - ihl);
+            REQUIRE(result.payload == std::vector<uint8_t>(packet.begin() + ihl, packet.end()));
+        }
+    }
+}
@@ -18,75 +18,7 @@
 #include "../../../sim/axis/AXISSink.hpp"
 #include "../../../sim/axis/AXISSource.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
-
-static inline unsigned short from32to16(unsigned int x)
-{
-    /* add up 16-bit and 16-bit for 16+c bit */
-    x = (x & 0xffff) + (x >> 16);
-    /* add up carry.. */
-    x = (x & 0xffff) + (x >> 16);
-    return x;
-}
-
-static unsigned int do_csum(const unsigned char *buff, int len)
-{
-    int odd;
-    unsigned int result = 0;
-
-    if (len <= 0)
-        goto out;
-    odd = 1 & (unsigned long) buff;
-    if (odd) {
-#ifdef __LITTLE_ENDIAN
-        result += (*buff << 8);
-#else
-        result = *buff;
-#endif
-        len--;
-        buff++;
-    }
-    if (len >= 2) {
-        if (2 & (unsigned long) buff) {
-            result += *(unsigned short *) buff;
-            len -= 2;
-            buff += 2;
-        }
-        if (len >= 4) {
-            const unsigned char *end = buff + ((unsigned)len & ~3);
-            unsigned int carry = 0;
-            do {
-                unsigned int w = *(unsigned int *) buff;
-                buff += 4;
-                result += carry;
-                result += w;
-                carry = (w > result);
-            } while (buff < end);
-            result += carry;
-            result = (result & 0xffff) + (result >> 16);
-        }
-        if (len & 2) {
-            result += *(unsigned short *) buff;
-            buff += 2;
-        }
-    }
-    if (len & 1)
-#ifdef __LITTLE_ENDIAN
-        result += *buff;
-#else
-    result += (*buff << 8);
-#endif
-    result = from32to16(result);
-    if (odd)
-        result = ((result >> 8) & 0xff) | ((result & 0xff) << 8);
-    out:
-    return result;
-}
-// This is adapted slightly to not use kernel types
-static uint16_t ip_compute_csum(const void *buff, int len)
-{
-    return (uint16_t)~do_csum((const unsigned char *)buff, len);
-}
-// End copied and pasted from linux/lib/checksum.c
+#include "../../../sim/network/PacketBuilder.hpp"
 
 auto testip(uint64_t src_ip, uint64_t dest_ip, uint8_t protocol, std::vector<std::vector<vluint8_t>> len, std::string vcdName="foo.vcd", bool recordVcd=false)
 {
@@ -124,18 +56,13 @@ TEST_CASE("Test with random UDP packet", "[ip_header_gen]")
 {
 	// Based off a packet captured off the wire
 	// Modified to match identification, TTL, etc.
-	std::vector<vluint8_t> outData =
-		{0x45,0x00, 0x00, 0x21,
-         0x00, 0x00, 0x40, 0x00,
-         0xFF, 0x11, 0x00, 0x00,
-		 0xC0, 0xA8, 0x00, 0x1F,
-		 0xC0, 0xA8, 0x00, 0x23}
-	;
-
-	auto csum = ip_compute_csum(outData.data(), outData.size());
-	std::cout << "Checksum: 0x" << std::hex << csum << std::dec << std::endl;
-	outData[10] = csum & 0xFF;
-	outData[11] = (csum >> 8) & 0xFF;
+	// Only the header is compared, so the 13 bytes of UDP header and payload are left as zeros
+	std::vector<uint8_t> packet;
+	PacketBuilder(packet)
+		.ipv4({.src = ipv4Address(192, 168, 0, 31), .dst = ipv4Address(192, 168, 0, 35), .protocol = 0x11, .identification = 0, .ttl = 0xFF})
+		.payload(std::vector<uint8_t>(13))
+		.finish();
+	std::vector<vluint8_t> outData(packet.begin(), packet.begin() + 20);
 
 	uint64_t src_ip = 0xC0A8001F; //192.168.0.31
 	uint64_t dest_ip = 0xC0A80023; //192.168.0.35
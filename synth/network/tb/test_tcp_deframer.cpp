@@ -18,6 +18,8 @@
 #include "../../../sim/axis/AXISSink.hpp"
 #include "../../../sim/axis/AXISSource.hpp"
 #include "../../../sim/other/PacketSourceSink.hpp"
+#include "../../../sim/other/SimRandom.hpp"
+#include "../../../sim/network/PacketBuilder.hpp"
 
 namespace {
     struct ret_data {
@@ -177,4 +179,38 @@ namespace {
         REQUIRE(result.window_size == 512);
         REQUIRE(result.payload == expected_data);
     }
-}
\ No newline at end of file
+
+    TEST_CASE("tcp_deframer: Test deframer with built TCP segments, with and without options", "[tcp_deframer]")
+    {
+        SimRandom random(49);
+        std::vector<vluint8_t> segment;
+        for(int i=0; i < 20; i++)
+        {
+            // Up to 40 bytes of no-ops, to move the start of the payload around
+            std::vector<uint8_t> options(4 * random.nextBelow(11), 0x01);
+            uint64_t numbers = random();
+            TcpHeader header{.src_port = static_cast<uint16_t>(random()), .dst_port = static_cast<uint16_t>(random()),
+                             .seq = static_cast<uint32_t>(numbers), .ack = static_cast<uint32_t>(numbers >> 32),
+                             .flags = static_cast<uint8_t>(random() & (TcpFlags::ACK | TcpFlags::RST | TcpFlags::SYN | TcpFlags::FIN)),
+                             .window = static_cast<uint16_t>(random()),
+                             .options = options};
+
+            // Without an IP layer there is no pseudo header, so the checksum is left as zero, which the deframer ignores anyway
+            size_t payload_length = 1 + random.nextBelow(200);
+            PacketBuilder(segment).tcp(header).payload(payload_length, random).finish();
+
+            auto result = testdeframer(segment);
+            REQUIRE(result.length_bytes == payload_length);
+            REQUIRE(result.src_port == header.src_port);
+            REQUIRE(result.dst_port == header.dst_port);
+            REQUIRE(result.seq_num == header.seq);
+            REQUIRE(result.ack_num == header.ack);
+            REQUIRE(result.ack == bool(header.flags & TcpFlags::ACK));
+            REQUIRE(result.rst == bool(header.flags & TcpFlags::RST));
+            REQUIRE(result.syn == bool(header.flags & TcpFlags::SYN));
+            REQUIRE(result.fin == bool(header.flags & TcpFlags::FIN));
+            REQUIRE(result.window_size == header.window);
+            REQUIRE(result.payload == std::vector<uint8_t>(segment.end() - payload_length, segment.end()));
+        }
+    }
+}